@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "pbm.h"
+#include "ppmcvt.h"
+
+/*
+Thumbnail kernels specialized at compile time. THUMBNAIL_KERNEL expands
+to one box-averaging kernel per (scale, accumulator) pair. With a
+constant scale the block loop has a fixed trip count that the compiler
+unrolls, and the divide by the block area becomes a shift; this is where
+the gain is, and 8-bit and 16-bit images share the 32-bit kernels at
+scales 2, 4 and 8 (max * 64 always fits). Sample depth only matters for
+the other scales: a 32-bit sum is used while max * scale^2 fits in 32
+bits, which covers 8-bit samples at almost any scale, and a 64-bit sum
+otherwise. Samples are stored as unsigned int whatever the depth, so
+16-bit accumulators for 8-bit images would not widen the loads; measured,
+they were no faster. The dispatcher picks a kernel once per image;
+--generic-kernels pins the runtime-scale 64-bit kernel, for comparison
+in ppmbench.
+*/
+
+int generic_kernels = 0;
+
+//Each source row is read once, front to back, and summed into per-channel
+//accumulators for the output row it belongs to
+#define THUMBNAIL_KERNEL(NAME, SCALE, ACC) \
+static void NAME(PPMImage *p, PPMImage *new_p, int scale){ \
+  (void)scale; \
+  unsigned int new_width = new_p->width; \
+  ACC area = (ACC)(SCALE) * (SCALE); \
+  ACC *acc = (ACC *)malloc((3 * (size_t)new_width + 1) * sizeof(ACC)); \
+  if (acc == NULL) { \
+    perror("Failed to allocate memory for thumbnail accumulators"); \
+    exit(EXIT_FAILURE); \
+  } \
+  for (unsigned int h = 0; h < new_p->height; h++) { \
+      memset(acc, 0, 3 * (size_t)new_width * sizeof(ACC)); \
+      for (int y = 0; y < (SCALE); y++) { \
+          for (int i = 0; i < 3; i++) { \
+              const unsigned int *src = p->pixmap[i][h*(SCALE) + y]; \
+              ACC *sum = acc + (size_t)i * new_width; \
+              for (unsigned int w = 0; w < new_width; w++) { \
+                  ACC block = 0; \
+                  for (int x = 0; x < (SCALE); x++) { \
+                      block += src[x]; \
+                  } \
+                  sum[w] += block; \
+                  src += (SCALE); \
+              } \
+          } \
+      } \
+      for (int i = 0; i < 3; i++) { \
+          const ACC *sum = acc + (size_t)i * new_width; \
+          unsigned int *dst = new_p->pixmap[i][h]; \
+          for (unsigned int w = 0; w < new_width; w++) { \
+              dst[w] = (unsigned int)(sum[w] / area); \
+          } \
+      } \
+  } \
+  free(acc); \
+}
+
+THUMBNAIL_KERNEL(thumbnail_2, 2, uint32_t)
+THUMBNAIL_KERNEL(thumbnail_4, 4, uint32_t)
+THUMBNAIL_KERNEL(thumbnail_8, 8, uint32_t)
+THUMBNAIL_KERNEL(thumbnail_narrow, scale, uint32_t)
+THUMBNAIL_KERNEL(thumbnail_generic, scale, unsigned long long)
+
+//Kernel for a scale, and for the other scales a sample depth
+ThumbnailKernel thumbnail_kernel(int scale, unsigned int max){
+  if (generic_kernels) {
+      return thumbnail_generic;
+  }
+  switch (scale) {
+      case 2: return thumbnail_2;
+      case 4: return thumbnail_4;
+      case 8: return thumbnail_8;
+  }
+  if ((unsigned long long)max * scale * scale <= UINT32_MAX) {
+      return thumbnail_narrow;
+  }
+  return thumbnail_generic;
+}
@@ -0,0 +1,62 @@
+#include "lut.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+static void *lut_alloc(size_t count, size_t size){
+  void *p = malloc(count * size + 1);
+  if(p == NULL){
+    perror("Failed to allocate memory for lookup table");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+//Is a table of `entries` paid back by an image (or strip) of `pixels`?
+int lut_worthwhile(size_t entries, size_t entry_bytes, size_t pixels){
+  return entries * LUT_MIN_PIXELS_PER_ENTRY <= pixels && entries * entry_bytes <= LUT_MAX_BYTES;
+}
+
+//Bit table, plus the gray table when want_gray is set
+void lut_sum_build(SumLUT *t, unsigned int max, int gray_value, int want_gray){
+  t->entries = 3 * max + 1;
+  t->bit = NULL;
+  t->gray = NULL;
+  if(want_gray){
+    t->gray = (unsigned int *)lut_alloc(t->entries, sizeof(unsigned int));
+    for(unsigned int s = 0; s < t->entries; s++){
+      t->gray[s] = gray_level(s, max, gray_value);
+    }
+  }else{
+    t->bit = (unsigned char *)lut_alloc(t->entries, 1);
+    for(unsigned int s = 0; s < t->entries; s++){
+      t->bit[s] = (unsigned char)bitmap_bit(s, max);
+    }
+  }
+}
+
+void lut_sum_free(SumLUT *t){
+  free(t->bit);
+  free(t->gray);
+}
+
+void lut_sepia_build(SepiaLUT *t, unsigned int max){
+  unsigned int size = 1;
+  while(size <= max){
+    size <<= 1;
+  }
+  t->mask = size - 1;
+  for(int c = 0; c < 3; c++){
+    t->product[c] = (double *)lut_alloc(3 * (size_t)size, sizeof(double));
+    for(unsigned int v = 0; v < size; v++){
+      for(int k = 0; k < 3; k++){
+        t->product[c][3 * v + k] = sepia_weight[k][c] * v;
+      }
+    }
+  }
+}
+
+void lut_sepia_free(SepiaLUT *t){
+  for(int c = 0; c < 3; c++){
+    free(t->product[c]);
+  }
+}
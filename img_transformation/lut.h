@@ -0,0 +1,60 @@
+/*
+Lookup tables for the point operations of ppmcvt. bitmap and grayscale
+depend only on r+g+b, and each sepia output is a sum of one product per
+input channel, so per-image tables built from max (and the gray level)
+replace the divides and multiplies of the inner loops. Table entries are
+computed with the same expressions as the direct code, so results are
+bit-identical; samples above max, which no table covers, take the direct
+path.
+*/
+#ifndef LUT_H
+#define LUT_H
+
+#include <stddef.h>
+
+// Pixels per table entry below which building a table costs more than it saves
+#define LUT_MIN_PIXELS_PER_ENTRY 4
+// Larger tables miss in cache often enough to lose to the arithmetic (16-bit sepia)
+#define LUT_MAX_BYTES ((size_t)1 << 20)
+
+// The point operations themselves, shared by the tables and the direct path
+static inline unsigned int bitmap_bit(unsigned int sum, unsigned int max){
+  unsigned int avg = (int)sum / 3;
+  return avg < (int)(max/2) ? 0 : 1;
+}
+
+static inline unsigned int gray_level(unsigned int sum, unsigned int max, int value){
+  unsigned int avg = sum / 3;
+  return (unsigned int)((avg*value)/max);
+}
+
+// Sepia weights: output channel k gets sepia_weight[k][c] times input channel c
+static const double sepia_weight[3][3] = {
+  {0.393, 0.769, 0.189},
+  {0.349, 0.686, 0.168},
+  {0.272, 0.534, 0.131},
+};
+
+// Tables indexed by r+g+b; `entries` is 3*max+1
+typedef struct {
+  unsigned int entries;
+  unsigned char *bit;         // bitmap: 0 or 1
+  unsigned int *gray;         // grayscale level
+} SumLUT;
+
+// Products for sepia: for input channel c and sample v, the three
+// contributions sepia_weight[k][c] * v are stored together at [c][3*v + k].
+// `mask` is one less than the power of two of entries, so (r|g|b) & ~mask
+// tells whether a pixel is covered.
+typedef struct {
+  unsigned int mask;
+  double *product[3];
+} SepiaLUT;
+
+int lut_worthwhile(size_t entries, size_t entry_bytes, size_t pixels);
+void lut_sum_build(SumLUT *t, unsigned int max, int gray_value, int want_gray);
+void lut_sum_free(SumLUT *t);
+void lut_sepia_build(SepiaLUT *t, unsigned int max);
+void lut_sepia_free(SepiaLUT *t);
+
+#endif
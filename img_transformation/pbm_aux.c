@@ -1,58 +1,139 @@
 #include "pbm.h"
+#include "ppmcvt.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <pthread.h>
 
 /*
 Mallocing space(new) and freeing it up (del)
+
+Every channel is a single block: the array of row pointers followed by all
+of the rows, so a channel is contiguous in memory and costs one malloc.
+When the pool is enabled (batch mode) freed blocks are parked on free lists
+by power-of-two size class and handed out again to the next image that fits.
 */
 
+#define POOL_CLASSES 64
+
+static int pool_enabled = 0;
+static size_t pool_limit = 0;          // max bytes parked on the free lists
+static size_t pool_bytes = 0;
+static void *pool_free[POOL_CLASSES];  // free lists, linked through each block's first word
+static unsigned long pool_reused = 0, pool_allocated = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void pbm_pool_enable(size_t limit_bytes)
+{
+  pool_enabled = 1;
+  pool_limit = limit_bytes;
+}
+
+void pbm_pool_stats(unsigned long *reused, unsigned long *allocated)
+{
+  pthread_mutex_lock(&pool_lock);
+  *reused = pool_reused;
+  *allocated = pool_allocated;
+  pthread_mutex_unlock(&pool_lock);
+}
+
+static size_t plane_bytes( unsigned int w, unsigned int h )
+{
+  return h * sizeof(unsigned int *) + (size_t)w * h * sizeof(unsigned int);
+}
+
+//Size class of a pooled block. Every class holds at least the free-list
+//link, even for a plane with no rows (a thumbnail smaller than its scale).
+static int size_class( size_t bytes )
+{
+  int k = 0;
+  if (bytes < sizeof(void *)) {
+    bytes = sizeof(void *);
+  }
+  while (((size_t)1 << k) < bytes) {
+    k++;
+  }
+  return k;
+}
+
+//Allocate one h x w plane and point its rows into the block
+static unsigned int ** new_plane( unsigned int w, unsigned int h )
+{
+  size_t bytes = plane_bytes(w, h);
+  void *block = NULL;
+
+  if (pool_enabled) {
+    int k = size_class(bytes);
+    pthread_mutex_lock(&pool_lock);
+    block = pool_free[k];
+    if (block != NULL) {
+      pool_free[k] = *(void **)block;
+      pool_bytes -= (size_t)1 << k;
+      pool_reused++;
+    } else {
+      pool_allocated++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (block == NULL) {
+      block = malloc((size_t)1 << k);
+    }
+  } else {
+    block = malloc(bytes ? bytes : 1);
+  }
+
+  if (block == NULL) {
+    return NULL;
+  }
+
+  unsigned int **rows = (unsigned int **)block;
+  unsigned int *samples = (unsigned int *)(rows + h);
+  for (unsigned int row = 0; row < h; row++) {
+    rows[row] = samples + (size_t)row * w;
+  }
+  return rows;
+}
+
+static void del_plane( unsigned int **rows, unsigned int w, unsigned int h )
+{
+  if (rows == NULL) {
+    return;
+  }
+
+  if (pool_enabled) {
+    int k = size_class(plane_bytes(w, h));
+    pthread_mutex_lock(&pool_lock);
+    if (pool_bytes + ((size_t)1 << k) <= pool_limit) {
+      *(void **)rows = pool_free[k];
+      pool_free[k] = rows;
+      pool_bytes += (size_t)1 << k;
+      rows = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+  }
+  free(rows);
+}
+
 PPMImage * new_ppmimage( unsigned int w, unsigned int h, unsigned int m )
 {
   PPMImage *ppm = (PPMImage *)malloc(sizeof(PPMImage)); //Allocate mem for PPMImage struct
-  if (ppm->pixmap == NULL) {
-     perror("Failed to allocate memory for pixmap");
-     free(ppm);
+  if (ppm == NULL) {
+     perror("Failed to allocate memory for PPMImage struct");
      exit(EXIT_FAILURE);
    }
-  
+
   for (int i = 0; i < 3; i++) {
-        // Allocate memory for the array of row pointers
-        ppm->pixmap[i] = (unsigned int **)malloc(h * sizeof(unsigned int *));
+        // One block per color channel: row pointers, then the rows
+        ppm->pixmap[i] = new_plane(w, h);
         if (ppm->pixmap[i] == NULL) {
-            perror("Failed to allocate memory for color channel rows");
-            // Free already allocated memory for other channels
+            perror("Failed to allocate memory for color channel");
+            // Free already allocated channels
             for (int j = 0; j < i; j++) {
-                for (unsigned int k = 0; k < h; k++) {
-                    free(ppm->pixmap[j][k]);
-                }
-                free(ppm->pixmap[j]);
+                del_plane(ppm->pixmap[j], w, h);
             }
             free(ppm);
             exit(EXIT_FAILURE);
         }
-        
-        for (unsigned int row = 0; row < h; row++) {
-            ppm->pixmap[i][row] = (unsigned int *)malloc(w * sizeof(unsigned int));
-            if (ppm->pixmap[i][row] == NULL) {
-                perror("Failed to allocate memory for color channel pixels");
-                // Free already allocated memory for this channel
-                for (unsigned int k = 0; k < row; k++) {
-                    free(ppm->pixmap[i][k]);
-                }
-                free(ppm->pixmap[i]);
-
-                // Free already allocated channels
-                for (int j = 0; j < i; j++) {
-                    for (unsigned int k = 0; k < h; k++) {
-                        free(ppm->pixmap[j][k]);
-                    }
-                    free(ppm->pixmap[j]);
-                }
-                free(ppm);
-                exit(EXIT_FAILURE);
-            }
-        }
     }
     ppm->width = w;
     ppm->height = h;
@@ -68,31 +149,17 @@ PBMImage * new_pbmimage( unsigned int w, unsigned int h )
     perror("Failed to allocate memory for PBMImage struct");
     exit(EXIT_FAILURE);
   }
-  
+
   pbm->width = w;
   pbm->height = h;
-  
+
   //Allocating pixmap memory
-  pbm->pixmap = (unsigned int **)malloc(h * sizeof(unsigned int *));
+  pbm->pixmap = new_plane(w, h);
   if (pbm->pixmap == NULL) {
     perror("Failed to allocate memory for pixmap");
     free(pbm);
     exit(EXIT_FAILURE);
   }
-  
-  //Allocate rows and col mem
-  for (unsigned int i = 0; i < h; i++) {
-    pbm->pixmap[i] = (unsigned int *)malloc(w * sizeof(unsigned int));
-    if (pbm->pixmap[i] == NULL) {
-        perror("Failed to allocate memory for pixmap row");
-        for (unsigned int j = 0; j < i; j++) {
-            free(pbm->pixmap[j]); // Free already allocated rows
-        }
-        free(pbm->pixmap);
-        free(pbm);
-        exit(EXIT_FAILURE);
-      }
-   }  
   return pbm;
 }
 
@@ -103,65 +170,39 @@ PGMImage * new_pgmimage( unsigned int w, unsigned int h, unsigned int m )
     perror("Failed to allocate memory for PGMImage struct");
     exit(EXIT_FAILURE);
   }
-  
+
   pgm->width = w;
   pgm->height = h;
   pgm->max = m;
-  
+
   //Allocating pixmap memory
-  pgm->pixmap = (unsigned int **)malloc(h * sizeof(unsigned int *));
+  pgm->pixmap = new_plane(w, h);
   if (pgm->pixmap == NULL) {
      perror("Failed to allocate memory for pixmap");
      free(pgm);
      exit(EXIT_FAILURE);
    }
-  
-  
-  //Allocate row and col mem
-  for(unsigned int i = 0; i < h; i++){
-    pgm->pixmap[i] = (unsigned int *)malloc(w * sizeof(unsigned int));
-    if (pgm->pixmap[i] == NULL) {
-     perror("Failed to allocate memory for pixmap row");
-     for (unsigned int j = 0; j < i; j++) {
-         free(pgm->pixmap[j]); // Free already allocated rows
-     }
-     free(pgm->pixmap);
-     free(pgm);
-     exit(EXIT_FAILURE);
-    }
-  }
-  
+
   return pgm;
-  
+
 }
 
 void del_ppmimage( PPMImage * p )
 {
   if(p != NULL){
-    unsigned int h = p->height;
-    
     for(int i=0; i<3; i++) {
-     if (p->pixmap[i] != NULL) {
-      for(unsigned int j = 0; j < h; j++){
-        free(p->pixmap[i][j]);
-      }
-      free(p->pixmap[i]);
-      }
+      del_plane(p->pixmap[i], p->width, p->height);
     }
     free(p);
   }
-}  
+}
 
 
 void del_pbmimage( PBMImage * p )
 {
   if(p != NULL){
-    unsigned int h = p->height;
-    for(unsigned int j = 0; j < h; j++){
-      free(p->pixmap[j]);
-    }
-  free(p->pixmap);
-  free(p);
+    del_plane(p->pixmap, p->width, p->height);
+    free(p);
   }
 }
 
@@ -169,12 +210,7 @@ void del_pbmimage( PBMImage * p )
 void del_pgmimage( PGMImage * p )
 {
   if(p != NULL){
-    unsigned int h = p->height;
-    for(unsigned int j = 0; j < h; j++){
-       free(p->pixmap[j]);
-     }
-    free(p->pixmap);
+    del_plane(p->pixmap, p->width, p->height);
     free(p);
   }
 }
-
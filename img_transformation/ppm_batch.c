@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pbm.h"
+#include "ppmcvt.h"
+#include "ppm_stream.h"
+
+/*
+Batch mode: convert every file of a manifest or directory with one process.
+Reader threads decode the next files while workers transform and write the
+current ones; decoded images wait in a bounded queue so memory stays at a
+few images per worker. Image buffers come from the pbm_aux.c pool and are
+recycled from one job to the next.
+*/
+
+#define POOL_LIMIT ((size_t)1 << 30)  // max bytes of free buffers kept for reuse
+#define MAX_PATH_LEN 4096
+
+// One input file, its output name and timings
+typedef struct {
+    char *input;
+    char output[MAX_PATH_LEN];
+    PPMImage *img;              // decoded image waiting for a worker
+    double read_time, transform_time, write_time;
+    int failed;
+} BatchJob;
+
+// Shared state between readers and workers
+typedef struct {
+    const Transform *t;
+    BatchJob *jobs;
+    int njobs;
+    int next_read;              // next job for the readers to decode
+    BatchJob **ready;           // ring of decoded jobs
+    int capacity, head, count;
+    int readers_left;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} BatchQueue;
+
+static int has_ppm_suffix(const char *name){
+  size_t len = strlen(name);
+  return len > 4 && strcmp(name + len - 4, ".ppm") == 0;
+}
+
+static int compare_names(const void *a, const void *b){
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+//Append a path to the growing input list
+static void add_input(char ***inputs, int *n, int *cap, char *path){
+  if(*n == *cap){
+    *cap = *cap ? *cap * 2 : 64;
+    *inputs = (char **)realloc(*inputs, *cap * sizeof(char *));
+    if(*inputs == NULL){
+      perror("Failed to allocate memory for input list");
+      exit(1);
+    }
+  }
+  (*inputs)[(*n)++] = path;
+}
+
+//Every *.ppm in a directory, or one path per line of a manifest ('#' starts a comment)
+static char **collect_inputs(const char *source, int *count){
+  char **inputs = NULL;
+  int n = 0, cap = 0;
+  struct stat st;
+
+  if(stat(source, &st) != 0){
+    perror(source);
+    exit(1);
+  }
+
+  if(S_ISDIR(st.st_mode)){
+    DIR *dir = opendir(source);
+    if(dir == NULL){
+      perror(source);
+      exit(1);
+    }
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL){
+      if(!has_ppm_suffix(entry->d_name)){
+        continue;
+      }
+      char *path = (char *)malloc(strlen(source) + strlen(entry->d_name) + 2);
+      sprintf(path, "%s/%s", source, entry->d_name);
+      add_input(&inputs, &n, &cap, path);
+    }
+    closedir(dir);
+    qsort(inputs, n, sizeof(char *), compare_names);
+  }else{
+    FILE *fp = fopen(source, "r");
+    if(fp == NULL){
+      perror(source);
+      exit(1);
+    }
+    char *line = NULL;
+    size_t len = 0;
+    while(getline(&line, &len, fp) != -1){
+      line[strcspn(line, "\r\n")] = '\0';
+      char *path = line + strspn(line, " \t");
+      if(path[0] == '\0' || path[0] == '#'){
+        continue;
+      }
+      add_input(&inputs, &n, &cap, strdup(path));
+    }
+    free(line);
+    fclose(fp);
+  }
+
+  *count = n;
+  return inputs;
+}
+
+//Replace the first %s of the template with the input's name minus directory and extension
+static void output_name(const char *out_template, const char *input, char *name, size_t len){
+  const char *base = strrchr(input, '/');
+  base = base ? base + 1 : input;
+  const char *dot = strrchr(base, '.');
+  int stem_len = (dot && dot != base) ? (int)(dot - base) : (int)strlen(base);
+  const char *mark = strstr(out_template, "%s");
+
+  snprintf(name, len, "%.*s%.*s%s", (int)(mark - out_template), out_template, stem_len, base, mark + 2);
+}
+
+static void *reader_main(void *arg){
+  BatchQueue *q = (BatchQueue *)arg;
+
+  while(1){
+    pthread_mutex_lock(&q->lock);
+    int idx = q->next_read++;
+    pthread_mutex_unlock(&q->lock);
+    if(idx >= q->njobs){
+      break;
+    }
+
+    BatchJob *job = &q->jobs[idx];
+    double start = now_seconds();
+    job->img = ppm_load(job->input);
+    job->read_time = now_seconds() - start;
+    if(job->img == NULL){
+      job->failed = 1;
+      continue;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    while(q->count == q->capacity){
+      pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->ready[(q->head + q->count) % q->capacity] = job;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  pthread_mutex_lock(&q->lock);
+  q->readers_left--;
+  pthread_cond_broadcast(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+static void *worker_main(void *arg){
+  BatchQueue *q = (BatchQueue *)arg;
+
+  while(1){
+    pthread_mutex_lock(&q->lock);
+    while(q->count == 0 && q->readers_left > 0){
+      pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    if(q->count == 0){
+      pthread_mutex_unlock(&q->lock);
+      break;
+    }
+    BatchJob *job = q->ready[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+
+    double timings[2];
+    if(convert_image(q->t, job->img, 1, job->output, timings) != 0){ //the image is freed right after
+      job->failed = 1;
+    }
+    job->transform_time = timings[0];
+    job->write_time = timings[1];
+    del_ppmimage(job->img);
+    job->img = NULL;
+  }
+  return NULL;
+}
+
+int batch_convert(const Transform *t, const char *source, const char *out_template, int workers){
+  int njobs;
+  char **inputs = collect_inputs(source, &njobs);
+  if(njobs == 0){
+    fprintf(stderr, "Error: No input files found in %s\n", source);
+    return 1;
+  }
+  if(workers <= 0){
+    workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(workers <= 0){
+      workers = 1;
+    }
+  }
+
+  printf("Converting %d files from %s with %d workers and saving to %s\n", njobs, source, workers, out_template);
+  pbm_pool_enable(POOL_LIMIT);
+
+  BatchQueue q;
+  memset(&q, 0, sizeof(q));
+  q.t = t;
+  q.njobs = njobs;
+  q.jobs = (BatchJob *)calloc(njobs, sizeof(BatchJob));
+  q.capacity = workers;
+  q.ready = (BatchJob **)calloc(workers, sizeof(BatchJob *));
+  q.readers_left = workers;
+  if(q.jobs == NULL || q.ready == NULL){
+    perror("Failed to allocate memory for batch jobs");
+    exit(1);
+  }
+  pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.not_empty, NULL);
+  pthread_cond_init(&q.not_full, NULL);
+
+  for(int i = 0; i < njobs; i++){
+    q.jobs[i].input = inputs[i];
+    output_name(out_template, inputs[i], q.jobs[i].output, MAX_PATH_LEN);
+  }
+
+  double start = now_seconds();
+  pthread_t *threads = (pthread_t *)malloc(2 * workers * sizeof(pthread_t));
+  if(threads == NULL){
+    perror("Failed to allocate memory for batch threads");
+    exit(1);
+  }
+  for(int i = 0; i < workers; i++){
+    if(pthread_create(&threads[i], NULL, reader_main, &q) != 0
+       || pthread_create(&threads[workers + i], NULL, worker_main, &q) != 0){
+      perror("Failed to start batch thread");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < 2 * workers; i++){
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = now_seconds() - start;
+
+  //Per-file timing summary
+  int failed = 0;
+  printf("%-40s %10s %10s %10s\n", "file", "read ms", "xform ms", "write ms");
+  for(int i = 0; i < njobs; i++){
+    BatchJob *job = &q.jobs[i];
+    if(job->failed){
+      printf("%-40s %10s\n", job->input, "failed");
+      failed++;
+    }else{
+      printf("%-40s %10.2f %10.2f %10.2f\n", job->input,
+             job->read_time * 1e3, job->transform_time * 1e3, job->write_time * 1e3);
+    }
+  }
+
+  unsigned long reused, allocated;
+  pbm_pool_stats(&reused, &allocated);
+  printf("%d files (%d failed) in %.2f s, %.1f files/s\n", njobs, failed, elapsed, njobs / elapsed);
+  printf("Buffer pool: %lu reused, %lu allocated\n", reused, allocated);
+
+  for(int i = 0; i < njobs; i++){
+    free(inputs[i]);
+  }
+  free(inputs);
+  free(threads);
+  free(q.ready);
+  free(q.jobs);
+  pthread_mutex_destroy(&q.lock);
+  pthread_cond_destroy(&q.not_empty);
+  pthread_cond_destroy(&q.not_full);
+
+  return failed ? 1 : 0;
+}
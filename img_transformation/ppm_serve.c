@@ -0,0 +1,382 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "pbm.h"
+#include "ppmcvt.h"
+#include "ppm_stream.h"
+
+/*
+Persistent service: ppmcvt --serve SOCKET accepts one request per connection
+on a Unix socket and keeps recently decoded images in a memory-bounded LRU
+keyed by path, mtime and size, so repeated transformations of the same source
+skip the decode.
+
+Request, one line:  <transformation flags> INPUT OUTPUT
+                    e.g. "-i red in.ppm out.ppm"; OUTPUT "-" streams the image back
+Reply, one line:    OK <microseconds> <hit|miss>   followed by the image for "-"
+                    ERR <message>
+Paths cannot contain spaces.
+
+Connections are served by a fixed set of threads that all accept on the
+socket, so a slow request does not hold up the others, and a client that
+sends nothing (or stops reading) is dropped after CLIENT_TIMEOUT seconds.
+The cache is shared under one lock; the decode and the transformation run
+outside it, and an entry evicted while a request still uses it is freed
+when that request is done.
+*/
+
+#define MAX_REQUEST 8192
+#define MAX_TOKENS 16
+#define MIN_SERVE_THREADS 4
+#define CLIENT_TIMEOUT 5   // seconds a client may take to send its request or read the reply
+
+// One decoded image in the cache, most recently used at the head
+typedef struct CacheEntry {
+    char *path;
+    struct timespec mtime;
+    off_t size;
+    PPMImage *img;
+    size_t bytes;
+    int users;              // requests still using img
+    int dropped;            // evicted; freed when the last user is done
+    struct CacheEntry *prev, *next;
+} CacheEntry;
+
+static CacheEntry *lru_head = NULL, *lru_tail = NULL;
+static size_t cache_used = 0, cache_limit = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *listen_path = NULL;
+
+static size_t image_bytes(PPMImage *img){
+  return 3 * ((size_t)img->height * sizeof(unsigned int *)
+              + (size_t)img->width * img->height * sizeof(unsigned int));
+}
+
+static void lru_unlink(CacheEntry *e){
+  if(e->prev) e->prev->next = e->next; else lru_head = e->next;
+  if(e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void lru_push_front(CacheEntry *e){
+  e->prev = NULL;
+  e->next = lru_head;
+  if(lru_head) lru_head->prev = e; else lru_tail = e;
+  lru_head = e;
+}
+
+static void entry_free(CacheEntry *e){
+  del_ppmimage(e->img);
+  free(e->path);
+  free(e);
+}
+
+//Evict e; a request still using it frees it in cache_release. Caller holds cache_lock.
+static void lru_drop(CacheEntry *e){
+  lru_unlink(e);
+  cache_used -= e->bytes;
+  if(e->users > 0){
+    e->dropped = 1;
+  }else{
+    entry_free(e);
+  }
+}
+
+//Fresh entry for path, moved to the front; a stale one is dropped. Caller holds cache_lock.
+static CacheEntry *cache_find(const char *path, const struct stat *st){
+  for(CacheEntry *e = lru_head; e != NULL; e = e->next){
+    if(strcmp(e->path, path) != 0){
+      continue;
+    }
+    if(e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec
+       && e->size == st->st_size){
+      lru_unlink(e);
+      lru_push_front(e);
+      return e;
+    }
+    lru_drop(e); //file changed since it was cached
+    break;
+  }
+  return NULL;
+}
+
+//Return the decoded image for path, from the cache when the file is unchanged.
+//*hit tells which. A cached image is held in *held until cache_release; *owned
+//is set instead when the image was too big to cache and the caller must free it.
+static PPMImage *cache_get(const char *path, int *hit, int *owned, CacheEntry **held, char *err, size_t errlen){
+  struct stat st;
+  *hit = 0;
+  *owned = 0;
+  *held = NULL;
+  if(stat(path, &st) != 0){
+    snprintf(err, errlen, "Cannot stat %s", path);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  CacheEntry *e = cache_find(path, &st);
+  if(e != NULL){
+    e->users++;
+    pthread_mutex_unlock(&cache_lock);
+    *hit = 1;
+    *held = e;
+    return e->img;
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  PPMImage *img = ppm_load(path);
+  if(img == NULL){
+    snprintf(err, errlen, "Cannot decode %s", path);
+    return NULL;
+  }
+
+  size_t bytes = image_bytes(img);
+  if(bytes > cache_limit){
+    *owned = 1;
+    return img;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  e = cache_find(path, &st);
+  if(e != NULL){
+    del_ppmimage(img); //another request decoded it meanwhile
+  }else{
+    while(cache_used + bytes > cache_limit && lru_tail != NULL){
+      lru_drop(lru_tail);
+    }
+    e = (CacheEntry *)calloc(1, sizeof(CacheEntry));
+    if(e == NULL){
+      pthread_mutex_unlock(&cache_lock);
+      *owned = 1;
+      return img;
+    }
+    e->path = strdup(path);
+    e->mtime = st.st_mtim;
+    e->size = st.st_size;
+    e->img = img;
+    e->bytes = bytes;
+    lru_push_front(e);
+    cache_used += bytes;
+  }
+  e->users++;
+  pthread_mutex_unlock(&cache_lock);
+  *held = e;
+  return e->img;
+}
+
+static void cache_release(CacheEntry *e){
+  if(e == NULL){
+    return;
+  }
+  pthread_mutex_lock(&cache_lock);
+  if(--e->users == 0 && e->dropped){
+    entry_free(e);
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+//Split the request line and validate it with the same rules as the command line
+static int parse_request(char *line, Transform *t, char **input, char **output, char *err, size_t errlen){
+  char *tokens[MAX_TOKENS];
+  char *save;
+  int n = 0;
+  for(char *tok = strtok_r(line, " \t\r\n", &save); tok != NULL; tok = strtok_r(NULL, " \t\r\n", &save)){
+    if(n == MAX_TOKENS){
+      snprintf(err, errlen, "Too many arguments");
+      return -1;
+    }
+    tokens[n++] = tok;
+  }
+
+  t->mode = 'b';
+  int transformation = 0, i = 0;
+  while(i < n && tokens[i][0] == '-' && tokens[i][1] != '\0'){
+    int opt = tokens[i][1];
+    if(tokens[i][2] != '\0' || strchr("bgirsmtnpR", opt) == NULL){
+      snprintf(err, errlen, "Unknown option %s", tokens[i]);
+      return -1;
+    }
+    if(transformation){
+      snprintf(err, errlen, "Multiple transformations specified");
+      return -1;
+    }
+    char *arg = NULL;
+    if(strchr("girtnpR", opt) != NULL){
+      if(++i == n){
+        snprintf(err, errlen, "Option -%c needs an argument", opt);
+        return -1;
+      }
+      arg = tokens[i];
+    }
+    if(set_transform(t, opt, arg, err, errlen) != 0){
+      //The command-line wording starts with "Error: "; the reply already says ERR
+      if(strncmp(err, "Error: ", 7) == 0){
+        memmove(err, err + 7, strlen(err + 7) + 1);
+      }
+      return -1;
+    }
+    transformation = 1;
+    i++;
+  }
+
+  if(n - i != 2){
+    snprintf(err, errlen, "Expected INPUT OUTPUT after the options");
+    return -1;
+  }
+  *input = tokens[i];
+  *output = tokens[i + 1];
+  return 0;
+}
+
+static void handle_client(int fd){
+  char line[MAX_REQUEST];
+  char err[512];
+  size_t len = 0;
+
+  struct timeval timeout = {CLIENT_TIMEOUT, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  //Read one request line
+  while(len < sizeof(line) - 1){
+    ssize_t got = read(fd, line + len, sizeof(line) - 1 - len);
+    if(got < 0){
+      close(fd); //timed out or gone before finishing its request
+      return;
+    }
+    if(got == 0){
+      break;
+    }
+    len += got;
+    if(memchr(line, '\n', len) != NULL){
+      break;
+    }
+  }
+  line[len] = '\0';
+
+  FILE *reply = fdopen(fd, "w");
+  if(reply == NULL){
+    close(fd);
+    return;
+  }
+
+  double start = now_seconds();
+  Transform t = {'b', NULL, 0, 0, 0};
+  char *input, *output;
+  int hit, owned;
+  CacheEntry *held = NULL;
+  PPMImage *img = NULL;
+
+  if(parse_request(line, &t, &input, &output, err, sizeof(err)) != 0){
+    fprintf(reply, "ERR %s\n", err);
+  }else if((img = cache_get(input, &hit, &owned, &held, err, sizeof(err))) == NULL){
+    fprintf(reply, "ERR %s\n", err);
+  }else if(strcmp(output, "-") == 0){
+    if(t.mode == 'p'){
+      fprintf(reply, "ERR A pyramid needs an output file name\n");
+    }else{
+      //Time covers decode and transform; the bytes follow the status line
+      char *body = NULL;
+      size_t body_len = 0;
+      FILE *mem = open_memstream(&body, &body_len);
+      convert_image_to(&t, img, owned, mem);
+      fclose(mem);
+      fprintf(reply, "OK %.0f %s\n", (now_seconds() - start) * 1e6, hit ? "hit" : "miss");
+      fwrite(body, 1, body_len, reply);
+      free(body);
+    }
+  }else if(t.mode == 'p'){
+    if(convert_image(&t, img, 0, output, NULL) != 0){
+      fprintf(reply, "ERR Cannot open %s levels for writing\n", output);
+    }else{
+      fprintf(reply, "OK %.0f %s\n", (now_seconds() - start) * 1e6, hit ? "hit" : "miss");
+    }
+  }else{
+    FILE *out = fopen(output, "w");
+    if(out == NULL){
+      fprintf(reply, "ERR Cannot open %s for writing\n", output);
+    }else{
+      convert_image_to(&t, img, owned, out);
+      if(stream_close_output(out) != 0){
+        fprintf(reply, "ERR Failed writing %s\n", output);
+      }else{
+        fprintf(reply, "OK %.0f %s\n", (now_seconds() - start) * 1e6, hit ? "hit" : "miss");
+      }
+    }
+  }
+
+  if(img != NULL && owned){
+    del_ppmimage(img);
+  }
+  cache_release(held);
+  fclose(reply);
+}
+
+static void *accept_main(void *arg){
+  int listen_fd = *(int *)arg;
+  while(1){
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd < 0){
+      perror("accept");
+      continue;
+    }
+    handle_client(fd);
+  }
+  return NULL;
+}
+
+static void handle_signal(int sig){
+  (void)sig;
+  unlink(listen_path);
+  _exit(0);
+}
+
+int serve(const char *socket_path, size_t cache_bytes){
+  struct sockaddr_un addr;
+  if(strlen(socket_path) >= sizeof(addr.sun_path)){
+    fprintf(stderr, "Error: Socket path too long: %s\n", socket_path);
+    return 1;
+  }
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listen_fd < 0){
+    perror("socket");
+    return 1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  unlink(socket_path);
+  if(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0){
+    perror(socket_path);
+    return 1;
+  }
+
+  cache_limit = cache_bytes;
+  listen_path = socket_path;
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  signal(SIGPIPE, SIG_IGN);
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = cpus > MIN_SERVE_THREADS ? (int)cpus : MIN_SERVE_THREADS;
+  printf("Serving on %s with a %zu MB image cache and %d threads\n", socket_path, cache_bytes >> 20, threads);
+  fflush(stdout);
+
+  for(int i = 1; i < threads; i++){
+    pthread_t tid;
+    if(pthread_create(&tid, NULL, accept_main, &listen_fd) != 0){
+      perror("Failed to start service thread");
+      exit(1);
+    }
+    pthread_detach(tid);
+  }
+  accept_main(&listen_fd);
+  return 0;
+}
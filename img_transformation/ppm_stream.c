@@ -0,0 +1,289 @@
+#include "ppm_stream.h"
+#include "ppm_text.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/*
+Header and sample parsing helpers
+*/
+
+// Skip whitespace and '#' comments, return the first significant char
+static int skip_space(FILE *fp){
+  int c;
+  while((c = getc(fp)) != EOF){
+    if(c == '#'){
+      while((c = getc(fp)) != EOF && c != '\n');
+    }else if(c != ' ' && c != '\t' && c != '\n' && c != '\r'){
+      break;
+    }
+  }
+  return c;
+}
+
+// Read one unsigned decimal value; returns -1 on EOF or a non-digit
+static int read_uint(FILE *fp, unsigned int *value){
+  int c = skip_space(fp);
+  if(c < '0' || c > '9'){
+    return -1;
+  }
+  unsigned int v = 0;
+  while(c >= '0' && c <= '9'){
+    v = v * 10 + (c - '0');
+    c = getc(fp);
+  }
+  if(c != EOF){
+    ungetc(c, fp);
+  }
+  *value = v;
+  return 0;
+}
+
+int ppm_reader_open(PPMReader *r, const char *filename){
+  memset(r, 0, sizeof(PPMReader));
+  r->fp = fopen(filename, "rb");
+  if(r->fp == NULL){
+    perror(filename);
+    return -1;
+  }
+
+  char magic[2];
+  if(fread(magic, 1, 2, r->fp) != 2 || magic[0] != 'P' || (magic[1] != '3' && magic[1] != '6')){
+    fprintf(stderr, "Error: %s is not a P3 or P6 file\n", filename);
+    fclose(r->fp);
+    return -1;
+  }
+  r->binary = (magic[1] == '6');
+
+  if(read_uint(r->fp, &r->width) || read_uint(r->fp, &r->height) || read_uint(r->fp, &r->max)
+     || r->max == 0 || r->max > 65535){
+    fprintf(stderr, "Error: Invalid PPM header in %s\n", filename);
+    fclose(r->fp);
+    return -1;
+  }
+
+  if(r->binary){
+    getc(r->fp); // single whitespace byte before the raster
+    size_t bytes = (size_t)r->width * 3 * (r->max < 256 ? 1 : 2);
+    r->raw = (unsigned char *)malloc(bytes ? bytes : 1);
+    if(r->raw == NULL){
+      perror("Failed to allocate memory for row buffer");
+      fclose(r->fp);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Fill up to `rows` rows of the strip, returns how many were read.
+// A truncated raster sets r->error and returns the rows read so far.
+unsigned int ppm_reader_read_strip(PPMReader *r, PPMImage *strip, unsigned int rows){
+  unsigned int n = 0;
+
+  while(n < rows && r->rows_read < r->height){
+    if(r->binary){
+      int wide = (r->max >= 256);
+      size_t bytes = (size_t)r->width * 3 * (wide ? 2 : 1);
+      if(fread(r->raw, 1, bytes, r->fp) != bytes){
+        fprintf(stderr, "Error: Unexpected end of raster at row %u\n", r->rows_read);
+        r->error = 1;
+        return n;
+      }
+      const unsigned char *src = r->raw;
+      for(unsigned int w = 0; w < r->width; w++){
+        for(int i = 0; i < 3; i++){
+          if(wide){
+            strip->pixmap[i][n][w] = (src[0] << 8) | src[1];
+            src += 2;
+          }else{
+            strip->pixmap[i][n][w] = *src++;
+          }
+        }
+      }
+    }else{
+      for(unsigned int w = 0; w < r->width; w++){
+        for(int i = 0; i < 3; i++){
+          if(read_uint(r->fp, &strip->pixmap[i][n][w])){
+            fprintf(stderr, "Error: Unexpected end of raster at row %u\n", r->rows_read);
+            r->error = 1;
+            return n;
+          }
+        }
+      }
+    }
+    n++;
+    r->rows_read++;
+  }
+  return n;
+}
+
+int ppm_raster_fits(unsigned int w, unsigned int h, unsigned int max, int binary, unsigned long long bytes){
+  unsigned long long samples = (unsigned long long)w * h;
+  if(samples > ULLONG_MAX / 6){
+    return 0;
+  }
+  samples *= 3;
+  if(binary){
+    return samples * (max < 256 ? 1 : 2) <= bytes;
+  }
+  return samples == 0 || samples * 2 - 1 <= bytes; // a digit per sample, a separator between them
+}
+
+// Decode a whole image; unlike read_ppmfile, a bad file returns NULL instead of exiting.
+// P3 files go through the parallel mmap decoder of ppm_text.c when it can take them.
+PPMImage *ppm_load(const char *filename){
+  PPMImage *fast = NULL;
+  int ret = text_load(filename, &fast);
+  if(ret <= 0){
+    return fast;
+  }
+
+  PPMReader reader;
+  if(ppm_reader_open(&reader, filename) != 0){
+    return NULL;
+  }
+  //A header far larger than the file would exit in new_ppmimage; only regular
+  //files have a size to check against
+  struct stat st;
+  long pos = ftell(reader.fp);
+  if(fstat(fileno(reader.fp), &st) == 0 && S_ISREG(st.st_mode) && pos >= 0
+     && !ppm_raster_fits(reader.width, reader.height, reader.max, reader.binary, st.st_size - pos)){
+    fprintf(stderr, "Error: %s is too short for its %u x %u header\n", filename, reader.width, reader.height);
+    ppm_reader_close(&reader);
+    return NULL;
+  }
+  PPMImage *img = new_ppmimage(reader.width, reader.height, reader.max);
+  ppm_reader_read_strip(&reader, img, reader.height);
+  ppm_reader_close(&reader);
+  
+  if(reader.error){
+    del_ppmimage(img);
+    return NULL;
+  }
+  return img;
+}
+
+void ppm_reader_close(PPMReader *r){
+  if(r->fp != NULL){
+    fclose(r->fp);
+  }
+  free(r->raw);
+  r->fp = NULL;
+  r->raw = NULL;
+}
+
+/*
+Incremental writers
+*/
+
+FILE *stream_open_output(const char *filename){
+  FILE *fp = fopen(filename, "w");
+  if(fp == NULL){
+    perror(filename);
+    exit(1);
+  }
+  return fp;
+}
+
+void stream_write_pbm_header(FILE *fp, unsigned int w, unsigned int h){
+  fprintf(fp, "P1\n%u %u\n", w, h);
+}
+
+void stream_write_pgm_header(FILE *fp, unsigned int w, unsigned int h, unsigned int max){
+  fprintf(fp, "P2\n%u %u\n%u\n", w, h, max);
+}
+
+void stream_write_ppm_header(FILE *fp, unsigned int w, unsigned int h, unsigned int max){
+  fprintf(fp, "P3\n%u %u\n%u\n", w, h, max);
+}
+
+// Format rows into one large buffer and hand it to stdio in big writes
+static void write_rows(FILE *fp, unsigned int **planes[], int channels, unsigned int width, unsigned int height){
+  size_t row_bytes = (size_t)width * channels * TEXT_SAMPLE_MAX + 1;
+  size_t cap = row_bytes > OUTPUT_BUFFER_SIZE ? row_bytes : OUTPUT_BUFFER_SIZE;
+  char *buf = (char *)malloc(cap);
+  if(buf == NULL){
+    perror("Failed to allocate memory for output buffer");
+    exit(1);
+  }
+
+  size_t len = 0;
+  unsigned int *rows[3];
+  for(unsigned int h = 0; h < height; h++){
+    if(cap - len < row_bytes){
+      fwrite(buf, 1, len, fp);
+      len = 0;
+    }
+    for(int i = 0; i < channels; i++){
+      rows[i] = planes[i][h];
+    }
+    len += text_format_row(buf + len, rows, channels, width);
+  }
+  fwrite(buf, 1, len, fp);
+  free(buf);
+}
+
+void stream_write_pbm_rows(FILE *fp, PBMImage *strip){
+  unsigned int **planes[1] = {strip->pixmap};
+  write_rows(fp, planes, 1, strip->width, strip->height);
+}
+
+void stream_write_pgm_rows(FILE *fp, PGMImage *strip){
+  unsigned int **planes[1] = {strip->pixmap};
+  write_rows(fp, planes, 1, strip->width, strip->height);
+}
+
+void stream_write_ppm_rows(FILE *fp, PPMImage *strip){
+  write_rows(fp, strip->pixmap, 3, strip->width, strip->height);
+}
+
+int stream_close_output(FILE *fp){
+  int failed = ferror(fp); //a write error fclose itself may not report again
+  if(fclose(fp) != 0 || failed){
+    perror("Error writing output");
+    return -1;
+  }
+  return 0;
+}
+
+//Output file for a save; NULL (after printing why) instead of exiting, so
+//batch and service callers can carry on with their other images
+static FILE *open_save(const char *filename){
+  FILE *fp = fopen(filename, "w");
+  if(fp == NULL){
+    perror(filename);
+  }
+  return fp;
+}
+
+int stream_save_pbm(PBMImage *img, const char *filename){
+  FILE *fp = open_save(filename);
+  if(fp == NULL){
+    return -1;
+  }
+  stream_write_pbm_header(fp, img->width, img->height);
+  stream_write_pbm_rows(fp, img);
+  return stream_close_output(fp);
+}
+
+int stream_save_pgm(PGMImage *img, const char *filename){
+  FILE *fp = open_save(filename);
+  if(fp == NULL){
+    return -1;
+  }
+  stream_write_pgm_header(fp, img->width, img->height, img->max);
+  stream_write_pgm_rows(fp, img);
+  return stream_close_output(fp);
+}
+
+int stream_save_ppm(PPMImage *img, const char *filename){
+  FILE *fp = open_save(filename);
+  if(fp == NULL){
+    return -1;
+  }
+  stream_write_ppm_header(fp, img->width, img->height, img->max);
+  stream_write_ppm_rows(fp, img);
+  return stream_close_output(fp);
+}
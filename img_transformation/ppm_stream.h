@@ -0,0 +1,46 @@
+/*
+Incremental PPM reading and PBM/PGM/PPM writing, used by ppmcvt to process
+images one strip of rows at a time instead of decoding them whole
+*/
+#ifndef PPM_STREAM_H
+#define PPM_STREAM_H
+
+#include <stdio.h>
+#include "pbm.h"
+
+#define DEFAULT_STRIP_ROWS 64  // rows per strip when -S is given 0
+#define OUTPUT_BUFFER_SIZE ((size_t)1 << 20)  // bytes of text formatted per write
+
+// Reader state: only the header and the current file position are kept
+typedef struct {
+    FILE *fp;
+    int binary;                 // 1 for P6 raw samples, 0 for P3 plain text
+    unsigned int width, height, max;
+    unsigned int rows_read;
+    int error;                  // set when the raster ends early
+    unsigned char *raw;         // one row of P6 bytes
+} PPMReader;
+
+int ppm_reader_open(PPMReader *r, const char *filename);
+unsigned int ppm_reader_read_strip(PPMReader *r, PPMImage *strip, unsigned int rows);
+void ppm_reader_close(PPMReader *r);
+PPMImage *ppm_load(const char *filename);
+// Could `bytes` of raster hold a w x h image with this max? Guards allocations
+// against headers that claim more than the file holds.
+int ppm_raster_fits(unsigned int w, unsigned int h, unsigned int max, int binary, unsigned long long bytes);
+
+// Writers emit the same plain-text layout as write_pbmfile/write_pgmfile/write_ppmfile.
+// The save functions write a whole image to a file and return -1 (after printing why) if that fails.
+FILE *stream_open_output(const char *filename);
+void stream_write_pbm_header(FILE *fp, unsigned int w, unsigned int h);
+void stream_write_pgm_header(FILE *fp, unsigned int w, unsigned int h, unsigned int max);
+void stream_write_ppm_header(FILE *fp, unsigned int w, unsigned int h, unsigned int max);
+void stream_write_pbm_rows(FILE *fp, PBMImage *strip);
+void stream_write_pgm_rows(FILE *fp, PGMImage *strip);
+void stream_write_ppm_rows(FILE *fp, PPMImage *strip);
+int stream_close_output(FILE *fp);
+int stream_save_pbm(PBMImage *img, const char *filename);
+int stream_save_pgm(PGMImage *img, const char *filename);
+int stream_save_ppm(PPMImage *img, const char *filename);
+
+#endif
@@ -0,0 +1,325 @@
+#include "ppm_text.h"
+#include "ppm_stream.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+P3 decoding from an mmap'd file. The raster is cut into one chunk per
+thread at whitespace, so no sample straddles two chunks. A first pass
+counts the samples of every chunk, which tells each chunk the index of its
+first sample; a second pass parses the chunks into the planes in parallel.
+Digits are classified and converted eight bytes at a time (SWAR), so the
+usual 1-5 digit sample costs a handful of branch-free operations.
+*/
+
+#define MIN_CHUNK_BYTES ((size_t)1 << 20)  // smaller chunks are not worth a thread
+#define MAX_TEXT_THREADS 64
+
+#define ONES   0x0101010101010101ULL
+#define HIGHS  0x8080808080808080ULL
+
+// One chunk of the raster and what its threads found
+typedef struct {
+    const char *begin, *end;
+    size_t first;           // index of the chunk's first sample
+    size_t count;           // samples in the chunk (first pass)
+    PPMImage *img;
+    size_t total;           // samples the image holds
+    int error;              // set by the second pass on a malformed sample
+} TextChunk;
+
+static int is_space(unsigned char c){
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+//Bytes of v that are ASCII digits, as 0x80 in each such byte. Works per byte
+//on the low 7 bits, so no carry crosses into a neighbouring byte.
+static uint64_t digit_bytes(uint64_t v){
+  uint64_t low = v & ~HIGHS;
+  uint64_t ge_0 = low + (0x80 - '0') * ONES;          // high bit set if low >= '0'
+  uint64_t gt_9 = low + (0x80 - '9' - 1) * ONES;      // high bit set if low > '9'
+  return ge_0 & ~gt_9 & ~v & HIGHS;
+}
+
+//Count the numbers in [p, end): digit bytes whose previous byte is not a digit
+static void *count_chunk(void *arg){
+  TextChunk *c = (TextChunk *)arg;
+  const char *p = c->begin;
+  size_t count = 0;
+  uint64_t carry = 0;   // 0x80 if the byte before the current word was a digit
+
+  for(; p + 8 <= c->end; p += 8){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    uint64_t d = digit_bytes(v);
+    count += __builtin_popcountll(d & ~((d << 8) | carry));
+    carry = d >> 56;
+  }
+  int prev = carry != 0;
+  for(; p < c->end; p++){
+    int digit = *p >= '0' && *p <= '9';
+    count += digit & !prev;
+    prev = digit;
+  }
+  c->count = count;
+  return NULL;
+}
+
+//Parse the decimal number at *pp, leaving *pp on the byte after it
+static unsigned int parse_number(const char **pp, const char *end){
+  const char *p = *pp;
+
+  if(p + 8 <= end){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    uint64_t t = v - '0' * ONES;
+    //Only the first non-digit matters, so a borrow out of it into later bytes is harmless
+    uint64_t non_digit = (t | (t + (0x80 - 10) * ONES)) & HIGHS;
+    if(non_digit != 0){
+      int len = __builtin_ctzll(non_digit) >> 3;
+      //Push the digits to the top bytes; the zero bytes shifted in read as leading zeros
+      t = len ? t << (64 - 8 * len) : 0;
+      t = (t * 10 + (t >> 8)) & 0x00FF00FF00FF00FFULL;
+      t = (t * 100 + (t >> 16)) & 0x0000FFFF0000FFFFULL;
+      t = (t * 10000 + (t >> 32)) & 0xFFFFFFFFULL;
+      *pp = p + len;
+      return (unsigned int)t;
+    }
+  }
+
+  //Eight or more digits, or too close to the end for a full word
+  unsigned int value = 0;
+  while(p < end && *p >= '0' && *p <= '9'){
+    value = value * 10 + (*p++ - '0');
+  }
+  *pp = p;
+  return value;
+}
+
+//Parse the chunk's samples into the planes, starting at sample index c->first
+static void *parse_chunk(void *arg){
+  TextChunk *c = (TextChunk *)arg;
+  const char *p = c->begin;
+  PPMImage *img = c->img;
+  size_t s = c->first;
+  if(s >= c->total){
+    return NULL;
+  }
+  size_t pixel = s / 3;
+  int channel = (int)(s % 3);
+  unsigned int row = (unsigned int)(pixel / img->width);
+  unsigned int col = (unsigned int)(pixel % img->width);
+
+  while(s < c->total){
+    while(p < c->end && is_space((unsigned char)*p)){
+      p++;
+    }
+    if(p == c->end){
+      break;
+    }
+    const char *start = p;
+    unsigned int value = parse_number(&p, c->end);
+    if(p == start || (p < c->end && !is_space((unsigned char)*p))){
+      c->error = 1;
+      return NULL;
+    }
+
+    img->pixmap[channel][row][col] = value;
+    s++;
+    if(++channel == 3){
+      channel = 0;
+      if(++col == img->width){
+        col = 0;
+        row++;
+      }
+    }
+  }
+  return NULL;
+}
+
+//Run fn over every chunk, one thread each beyond the first
+static void run_chunks(TextChunk *chunks, int n, void *(*fn)(void *)){
+  pthread_t tids[MAX_TEXT_THREADS];
+  for(int i = 1; i < n; i++){
+    if(pthread_create(&tids[i], NULL, fn, &chunks[i]) != 0){
+      perror("Failed to start decoder thread");
+      exit(EXIT_FAILURE);
+    }
+  }
+  fn(&chunks[0]);
+  for(int i = 1; i < n; i++){
+    pthread_join(tids[i], NULL);
+  }
+}
+
+//Header value at *pp, skipping whitespace and comments; -1 if there is none
+static int header_uint(const char **pp, const char *end, unsigned int *value){
+  const char *p = *pp;
+  while(p < end && (is_space((unsigned char)*p) || *p == '#')){
+    if(*p == '#'){
+      while(p < end && *p != '\n'){
+        p++;
+      }
+    }else{
+      p++;
+    }
+  }
+  if(p == end || *p < '0' || *p > '9'){
+    return -1;
+  }
+  unsigned int v = 0;
+  while(p < end && *p >= '0' && *p <= '9'){
+    v = v * 10 + (*p++ - '0');
+  }
+  *pp = p;
+  *value = v;
+  return 0;
+}
+
+static int decode(const char *filename, const char *data, size_t size, PPMImage **out){
+  const char *end = data + size;
+  const char *p = data + 2;
+  unsigned int width, height, max;
+  if(header_uint(&p, end, &width) || header_uint(&p, end, &height) || header_uint(&p, end, &max)
+     || max == 0 || max > 65535){
+    fprintf(stderr, "Error: Invalid PPM header in %s\n", filename);
+    return -1;
+  }
+  if(memchr(p, '#', end - p) != NULL){
+    return 1; // comments in the raster: leave them to the stdio reader
+  }
+  if(!ppm_raster_fits(width, height, max, 0, end - p)){
+    fprintf(stderr, "Error: %s is too short for its %u x %u header\n", filename, width, height);
+    return -1;
+  }
+
+  size_t total = (size_t)width * height * 3;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n = (int)((end - p) / MIN_CHUNK_BYTES);
+  if(cpus > 0 && n > cpus){
+    n = (int)cpus;
+  }
+  if(n > MAX_TEXT_THREADS){
+    n = MAX_TEXT_THREADS;
+  }
+  if(n < 1){
+    n = 1;
+  }
+
+  PPMImage *img = new_ppmimage(width, height, max);
+  TextChunk chunks[MAX_TEXT_THREADS];
+  const char *cut = p;
+  for(int i = 0; i < n; i++){
+    chunks[i].begin = cut;
+    cut = (i == n - 1) ? end : p + (size_t)(end - p) * (i + 1) / n;
+    if(cut < chunks[i].begin){
+      cut = chunks[i].begin;
+    }
+    while(cut < end && !is_space((unsigned char)*cut)){
+      cut++; // resynchronize on whitespace so the next chunk starts between samples
+    }
+    chunks[i].end = cut;
+    chunks[i].img = img;
+    chunks[i].total = total;
+    chunks[i].error = 0;
+  }
+
+  run_chunks(chunks, n, count_chunk);
+  size_t found = 0;
+  for(int i = 0; i < n; i++){
+    chunks[i].first = found;
+    found += chunks[i].count;
+  }
+  if(found < total){
+    fprintf(stderr, "Error: Unexpected end of raster at row %u\n", (unsigned int)(found / 3 / (width ? width : 1)));
+    del_ppmimage(img);
+    return -1;
+  }
+
+  run_chunks(chunks, n, parse_chunk);
+  for(int i = 0; i < n; i++){
+    if(chunks[i].error){
+      fprintf(stderr, "Error: Invalid sample in the raster of %s\n", filename);
+      del_ppmimage(img);
+      return -1;
+    }
+  }
+  *out = img;
+  return 0;
+}
+
+int text_load(const char *filename, PPMImage **img){
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0){
+    return 1; // let the stdio reader report it
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 2){
+    close(fd);
+    return 1;
+  }
+  char *data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED){
+    return 1;
+  }
+
+  int ret = 1;
+  if(data[0] == 'P' && data[1] == '3'){
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    ret = decode(filename, data, st.st_size, img);
+  }
+  munmap(data, st.st_size);
+  return ret;
+}
+
+/*
+Formatting
+*/
+
+// "00" to "99", so two digits are written per table lookup
+static const char digit_pairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+//Write v in decimal at p and return the byte after it
+static char *put_uint(char *p, unsigned int v){
+  int len = v < 10 ? 1 : v < 100 ? 2 : v < 1000 ? 3 : v < 10000 ? 4 : v < 100000 ? 5
+          : v < 1000000 ? 6 : v < 10000000 ? 7 : v < 100000000 ? 8 : v < 1000000000 ? 9 : 10;
+  char *q = p + len;
+  while(v >= 100){
+    unsigned int pair = v % 100;
+    v /= 100;
+    q -= 2;
+    memcpy(q, digit_pairs + 2 * pair, 2);
+  }
+  if(v >= 10){
+    memcpy(q - 2, digit_pairs + 2 * v, 2);
+  }else{
+    q[-1] = (char)('0' + v);
+  }
+  return p + len;
+}
+
+size_t text_format_row(char *out, unsigned int *const *rows, int channels, unsigned int width){
+  char *p = out;
+  for(unsigned int w = 0; w < width; w++){
+    for(int i = 0; i < channels; i++){
+      p = put_uint(p, rows[i][w]);
+      *p++ = ' ';
+    }
+  }
+  if(p > out){
+    p--; // no separator after the last sample
+  }
+  *p++ = '\n';
+  return p - out;
+}
@@ -0,0 +1,24 @@
+/*
+Fast plain-text (P3) decoding and P1/P2/P3 sample formatting. Decoding
+parses an mmap'd file in chunks on several threads; formatting turns
+samples into decimal text with a digit-pair table instead of printf.
+*/
+#ifndef PPM_TEXT_H
+#define PPM_TEXT_H
+
+#include <stddef.h>
+#include "pbm.h"
+
+#define TEXT_SAMPLE_MAX 11  // bytes per formatted sample: up to 10 digits and a separator
+
+// Decode a P3 file into *img. Returns 0 on success, -1 if the file is bad
+// (after printing why), or 1 if this path cannot take it (not a P3 regular
+// file, or comments inside the raster) and the stdio reader should.
+int text_load(const char *filename, PPMImage **img);
+
+// Format one row of `channels` interleaved planes as "a b c ...\n", the
+// layout of the stream writers; out needs width * channels * TEXT_SAMPLE_MAX
+// bytes. Returns the number of bytes written.
+size_t text_format_row(char *out, unsigned int *const *rows, int channels, unsigned int width);
+
+#endif
@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+Benchmark harness for ppmcvt. Every transformation mode is run on every
+input image in a child process started with -v, which reports decode,
+transform and encode times on stderr; peak RSS comes from the child's
+rusage. The best of -r runs (by wall time) is printed as one CSV row.
+With -G every mode is run again with --generic-kernels, as <mode>_generic
+rows, to show what the specialized kernels gain.
+
+  ppmbench [-x PPMCVT] [-r runs] [-o scratch output] [-G] IMAGE...
+*/
+
+#define MAX_ARGS 16
+#define MAX_ERR 4096
+
+// One mode of the sweep: a label for the CSV and the ppmcvt options
+typedef struct {
+    const char *label;
+    const char *args[3];
+} BenchMode;
+
+static const BenchMode modes[] = {
+    {"bitmap",    {"-b"}},
+    {"grayscale", {"-g", "255"}},
+    {"isolate",   {"-i", "red"}},
+    {"remove",    {"-r", "green"}},
+    {"sepia",     {"-s"}},
+    {"mirror",    {"-m"}},
+    {"thumbnail", {"-t", "4"}},
+    {"tile",      {"-n", "4"}},
+    {"resize_box",      {"-R", "320x240:box"}},
+    {"resize_bilinear", {"-R", "320x240:bilinear"}},
+    {"resize_lanczos",  {"-R", "320x240:lanczos"}},
+};
+
+// Measurements of one ppmcvt run
+typedef struct {
+    double decode, transform, encode, wall;
+    unsigned int width, height;
+    long max_rss_kb;
+} BenchRun;
+
+void print_usage(){
+      fprintf(stderr, "Usage: ppmbench [-x PPMCVT] [-r runs] [-o scratch output] [-G] IMAGE...\n");
+      exit(1);
+}
+
+double now_seconds(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Magic and maxval of the input, for the CSV; -1 if it is not a P3/P6 file
+static int read_header(const char *path, char *format, unsigned int *max){
+  FILE *fp = fopen(path, "rb");
+  if(fp == NULL){
+    perror(path);
+    return -1;
+  }
+  unsigned int w, h;
+  int ok = fscanf(fp, "P%c %u %u %u", format, &w, &h, max) == 4 && (*format == '3' || *format == '6');
+  fclose(fp);
+  if(!ok){
+    fprintf(stderr, "Error: %s is not a P3 or P6 file without header comments\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+//Run ppmcvt once with the mode's options; returns 0 and fills run on success
+static int run_once(const char *ppmcvt, const BenchMode *mode, int generic, const char *image, const char *scratch, BenchRun *run){
+  const char *argv[MAX_ARGS];
+  int argc = 0;
+  argv[argc++] = ppmcvt;
+  if(generic){
+    argv[argc++] = "--generic-kernels";
+  }
+  for(int i = 0; i < 3 && mode->args[i] != NULL; i++){
+    argv[argc++] = mode->args[i];
+  }
+  argv[argc++] = "-v";
+  argv[argc++] = "-o";
+  argv[argc++] = scratch;
+  argv[argc++] = image;
+  argv[argc] = NULL;
+
+  int fds[2];
+  if(pipe(fds) != 0){
+    perror("pipe");
+    exit(1);
+  }
+
+  fflush(stdout); //or the child would flush our pending CSV rows too
+  double start = now_seconds();
+  pid_t pid = fork();
+  if(pid < 0){
+    perror("fork");
+    exit(1);
+  }
+  if(pid == 0){
+    //stdout carries ppmcvt's progress message, which the CSV does not need
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    if(freopen("/dev/null", "w", stdout) == NULL){
+      _exit(127);
+    }
+    execv(ppmcvt, (char * const *)argv);
+    perror(ppmcvt);
+    _exit(127);
+  }
+  close(fds[1]);
+
+  char err[MAX_ERR];
+  size_t len = 0;
+  ssize_t got;
+  while((got = read(fds[0], err + len, sizeof(err) - 1 - len)) > 0){
+    len += got;
+  }
+  err[len] = '\0';
+  close(fds[0]);
+
+  int status;
+  struct rusage usage;
+  if(wait4(pid, &status, 0, &usage) < 0){
+    perror("wait4");
+    exit(1);
+  }
+  run->wall = now_seconds() - start;
+  run->max_rss_kb = usage.ru_maxrss;
+
+  const char *line = strstr(err, "Timings:");
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0 || line == NULL
+     || sscanf(line, "Timings: decode %lf s, transform %lf s, encode %lf s, %u x %u",
+               &run->decode, &run->transform, &run->encode, &run->width, &run->height) != 5){
+    fprintf(stderr, "Error: %s %s failed:\n%s", mode->label, image, err);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]){
+  int opt;
+  const char *ppmcvt = "./ppmcvt";
+  const char *scratch = "ppmbench_out.tmp";
+  int runs = 3;
+  int generic = 0;
+
+  while((opt = getopt(argc, argv, "x:r:o:G")) != -1){
+    switch(opt){
+      case 'x':
+        ppmcvt = optarg;
+        break;
+      case 'r':
+        runs = atoi(optarg);
+        if(runs <= 0){
+          fprintf(stderr, "Error: Invalid run count: %s; must be greater than 0\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'o':
+        scratch = optarg;
+        break;
+      case 'G':
+        generic = 1;
+        break;
+      default:
+        print_usage();
+    }
+  }
+  if(optind >= argc){
+    print_usage();
+  }
+
+  int failed = 0;
+  printf("image,format,width,height,max,mode,decode_s,transform_s,encode_s,wall_s,mpix_per_s,max_rss_kb\n");
+  for(int i = optind; i < argc; i++){
+    char format;
+    unsigned int max;
+    if(read_header(argv[i], &format, &max) != 0){
+      failed = 1;
+      continue;
+    }
+
+    for(int g = 0; g <= generic; g++){
+      for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++){
+        BenchRun best, run;
+        int ok = 0;
+        for(int r = 0; r < runs; r++){
+          if(run_once(ppmcvt, &modes[m], g, argv[i], scratch, &run) != 0){
+            ok = 0;
+            break;
+          }
+          if(!ok || run.wall < best.wall){
+            best = run;
+          }
+          ok = 1;
+        }
+        if(!ok){
+          failed = 1;
+          continue;
+        }
+
+        //Throughput of the three phases over the input's pixels, leaving out process startup
+        double phases = best.decode + best.transform + best.encode;
+        double mpix = (double)best.width * best.height / 1e6;
+        printf("%s,P%c,%u,%u,%u,%s%s,%.6f,%.6f,%.6f,%.6f,%.2f,%ld\n", argv[i], format, best.width, best.height, max,
+               modes[m].label, g ? "_generic" : "", best.decode, best.transform, best.encode, best.wall,
+               phases > 0 ? mpix / phases : 0, best.max_rss_kb);
+      }
+    }
+  }
+
+  unlink(scratch);
+  return failed;
+}
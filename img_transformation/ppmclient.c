@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+Client for ppmcvt --serve. Sends one transformation request and prints the
+reply; with -N it repeats the request and reports latency of the first
+(cold, decoded from disk) call against the following (warm, cached) ones.
+
+  ppmclient [-N count] SOCKET [-bgirsmtnpR ...] INPUT OUTPUT
+*/
+
+#define MAX_REQUEST 8192
+
+void print_usage(){
+      fprintf(stderr, "Usage: ppmclient [-N count] SOCKET [-bgirsmtnpR ...] INPUT OUTPUT\n");
+      exit(1);
+}
+
+double now_seconds(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Send the request and read the reply; the status line goes into status and
+//any image that follows is copied to body_out (or dropped if NULL)
+int send_request(const char *socket_path, const char *request, char *status, size_t len, FILE *body_out){
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0){
+    perror("socket");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+    perror(socket_path);
+    close(fd);
+    return -1;
+  }
+
+  size_t req_len = strlen(request);
+  if(write(fd, request, req_len) != (ssize_t)req_len){
+    perror("write");
+    close(fd);
+    return -1;
+  }
+
+  FILE *reply = fdopen(fd, "r");
+  if(reply == NULL || fgets(status, len, reply) == NULL){
+    fprintf(stderr, "Error: No reply from %s\n", socket_path);
+    if(reply) fclose(reply); else close(fd);
+    return -1;
+  }
+  status[strcspn(status, "\n")] = '\0';
+
+  char buffer[65536];
+  size_t got;
+  while((got = fread(buffer, 1, sizeof(buffer), reply)) > 0){
+    if(body_out != NULL){
+      fwrite(buffer, 1, got, body_out);
+    }
+  }
+  fclose(reply);
+  return strncmp(status, "OK", 2) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]){
+  int opt;
+  int count = 1;
+
+  //'+' stops at SOCKET so the request's own flags are passed through
+  while((opt = getopt(argc, argv, "+N:")) != -1){
+    switch(opt){
+      case 'N':
+        count = atoi(optarg);
+        if(count <= 0){
+          fprintf(stderr, "Error: Invalid repeat count: %s\n", optarg);
+          exit(1);
+        }
+        break;
+      default:
+        print_usage();
+    }
+  }
+  if(argc - optind < 3){
+    print_usage();
+  }
+
+  const char *socket_path = argv[optind];
+  char request[MAX_REQUEST] = "";
+  for(int i = optind + 1; i < argc; i++){
+    if(strlen(request) + strlen(argv[i]) + 2 >= sizeof(request)){
+      fprintf(stderr, "Error: Request too long\n");
+      exit(1);
+    }
+    strcat(request, argv[i]);
+    strcat(request, i + 1 < argc ? " " : "\n");
+  }
+
+  char status[512];
+  double cold = 0, warm_sum = 0, warm_min = 0, warm_max = 0;
+  for(int i = 0; i < count; i++){
+    double start = now_seconds();
+    //Only a single request writes a streamed image to stdout
+    if(send_request(socket_path, request, status, sizeof(status), count == 1 ? stdout : NULL) != 0){
+      fprintf(stderr, "%s\n", status);
+      exit(1);
+    }
+    double elapsed = (now_seconds() - start) * 1e3;
+
+    if(i == 0){
+      cold = elapsed;
+      fprintf(stderr, "%s\n", status);
+    }else{
+      warm_sum += elapsed;
+      if(i == 1 || elapsed < warm_min) warm_min = elapsed;
+      if(i == 1 || elapsed > warm_max) warm_max = elapsed;
+    }
+  }
+
+  if(count > 1){
+    fprintf(stderr, "cold: %.3f ms\n", cold);
+    fprintf(stderr, "warm: %.3f ms mean, %.3f min, %.3f max over %d requests\n",
+            warm_sum / (count - 1), warm_min, warm_max, count - 1);
+  }
+  return 0;
+}
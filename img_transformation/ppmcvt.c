@@ -2,146 +2,171 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <string.h>
+#include <time.h>
 #include "pbm.h"
+#include "ppmcvt.h"
+#include "ppm_stream.h"
+#include "lut.h"
 
 void print_usage(){
-      fprintf(stderr, "Usage: ppmcvt [-bgirsmtno] [FILE]\n");
+      fprintf(stderr, "Usage: ppmcvt [-bgirsmtnpRoSv] [--generic-kernels] [-B SOURCE [-j N]] [FILE]\n"
+                      "       ppmcvt --serve SOCKET [--cache-mb N]\n");
       exit(1);
 }
 
-//Decalring transfromation functions
-PBMImage* bitmap(PPMImage *p);
-PGMImage* grayscale(PPMImage * p, int value);
-PPMImage* isolate(PPMImage * p, char* color);
-PPMImage* remove_channel(PPMImage * p, char* color);
-PPMImage* sepia(PPMImage * p);
-PPMImage* mirror(PPMImage * p);
-PPMImage* thumbnail(PPMImage * p, int scale);
-PPMImage* tile(PPMImage * p, int scale);
+//Record one transformation option (-b -g -i -r -s -m -t -n -p -R) in t.
+//Returns -1 with a message in err if its argument is invalid.
+int set_transform(Transform *t, int opt, char *arg, char *err, size_t errlen){
+  switch(opt){
+    case 'g': // convert to pgm format
+      t->value = atoi(arg);
+      if(t->value <= 0 || t->value > 65535){
+        snprintf(err, errlen, "Error: Invalid max grayscale pixel value: %s; must be less than 65,536", arg);
+        return -1;
+      }
+      break;
+      
+    case 'i': //Isolate a color channel
+    case 'r': //remove a color channel
+      if (strcmp(arg, "red") != 0 && strcmp(arg, "green") != 0 && strcmp(arg, "blue") != 0) {
+        snprintf(err, errlen, "Error: Invalid channel specification: (%s); should be 'red', 'green', or 'blue'", arg);
+        return -1;
+      }
+      t->channel = arg;
+      break;
+      
+    case 't': //thumbnail transformation
+      t->scale = atoi(arg);
+      if (t->scale <= 0) {
+        snprintf(err, errlen, "Error: Invalid scale factor: %d; must be greater than 0", t->scale);
+        return -1;
+      }
+      break;
+      
+    case 'n': //tiling thumbnails
+      t->scale = atoi(arg);
+      if (t->scale < 1 || t->scale > 8 ) {
+        snprintf(err, errlen, "Error: Invalid scale factor: %d; must be 1-8", t->scale);
+        return -1;
+      }
+      break;
+      
+    case 'p': //pyramid of successively halved thumbnails
+      t->levels = atoi(arg);
+      if (t->levels < 1 || t->levels > MAX_PYRAMID_LEVELS) {
+        snprintf(err, errlen, "Error: Invalid number of levels: %d; must be 1-%d", t->levels, MAX_PYRAMID_LEVELS);
+        return -1;
+      }
+      break;
+      
+    case 'R': //resize to WIDTHxHEIGHT, optionally :box, :bilinear or :lanczos (the default)
+    {
+      char tail;
+      int used = 0;
+      if (sscanf(arg, "%ux%u%n", &t->width, &t->height, &used) != 2
+          || t->width == 0 || t->height == 0 || t->width > MAX_RESIZE_DIM || t->height > MAX_RESIZE_DIM
+          || (arg[used] != '\0' && sscanf(arg + used, ":%c", &tail) != 1)) {
+        snprintf(err, errlen, "Error: Invalid size: %s; must be WIDTHxHEIGHT[:FILTER] with sides 1-%d", arg, MAX_RESIZE_DIM);
+        return -1;
+      }
+      t->filter = FILTER_LANCZOS;
+      if (arg[used] != '\0' && (t->filter = resize_filter_parse(arg + used + 1)) < 0) {
+        snprintf(err, errlen, "Error: Invalid filter: %s; should be 'box', 'bilinear' or 'lanczos'", arg + used + 1);
+        return -1;
+      }
+      break;
+    }
+  }
+  t->mode = opt;
+  return 0;
+}
 
 int main( int argc, char *argv[] )
 {
     int opt;
     int transformation = 0; //Keeps track of no. of transf. applied/specified - always [0-1]
-    int grayscale_max = 0; 
-    char *channel; //Store the color channel specified for isolate and remove
-    int scale = 0; //scale factor for thumbnail and tile transformation
+    Transform t = {'b', NULL, 0, 0, 0}; //bitmap is the default mode
+    char err[256];
     char *output_file = NULL; 
     char *input_file = NULL;    
     
-    int pbm_mode = 0; //Default mode 
-    int pgm_mode = 0, iso_mode = 0, rem_mode = 0, sepia_mode = 0;
-    int mirr_mode = 0, tnail_mode = 0, tile_mode = 0;
+    int stream_mode = 0; //Read/transform/write in strips instead of whole images
+    int strip_rows = 0;
+    char *batch_source = NULL; //Manifest file or directory of inputs for batch mode
+    int workers = 0;
+    char *serve_socket = NULL; //Unix socket path for the persistent service
+    long cache_mb = DEFAULT_CACHE_MB;
+    int verbose = 0; //Report decode/transform/encode times on stderr
+    
+    static struct option long_options[] = {
+        {"serve",    required_argument, NULL, SERVE_OPT},
+        {"cache-mb", required_argument, NULL, CACHE_OPT},
+        {"generic-kernels", no_argument, NULL, GENERIC_OPT},
+        {NULL, 0, NULL, 0}
+    };
     
     //getopt parsing the command line arguments
-    while((opt = getopt(argc, argv, "bg:i:r:smt:n:o:")) != -1){
+    while((opt = getopt_long(argc, argv, "bg:i:r:smt:n:p:R:o:S:B:j:v", long_options, NULL)) != -1){
       switch(opt){
-        case 'b': //
+        case 'b': case 'g': case 'i': case 'r': case 's':
+        case 'm': case 't': case 'n': case 'p': case 'R':
           if(transformation){
             fprintf(stderr, "Error: Multiple transformations specified\n");
             exit(1); 
           }
-          pbm_mode = 1;
-          transformation = 1;
-          break;
-          
-        case 'g': // convert to pgm format
-          if(transformation){
-            fprintf(stderr, "Error: Multiple transformations specified\n");
-            exit(1); 
-          }
-          
-          grayscale_max = atoi(optarg);
-          if(grayscale_max <= 0 || grayscale_max > 65535){
-            fprintf(stderr, "Error: Invalid max grayscale pixel value: %s; must be less than 65,536\n", optarg);
+          if(set_transform(&t, opt, optarg, err, sizeof(err)) != 0){
+            fprintf(stderr, "%s\n", err);
             exit(1);
           }
-                    
-          pgm_mode = 1;
           transformation = 1;
           break;
-      
-        case 'i': //Isolate a color channel
-          if(transformation){
-            fprintf(stderr, "Error: Multiple transformations specified\n");
-            exit(1); 
-          }
-          channel = optarg;
-          if (strcmp(channel, "red") != 0 && strcmp(channel, "green") != 0 && strcmp(channel, "blue") != 0) {
-            fprintf(stderr, "Error: Invalid channel specification: (%s); should be 'red', 'green', or 'blue'\n", channel);
-            exit(1);
-          }
-          iso_mode = 1;
-          transformation = 1;
+          
+        case 'o': //handling the output option
+          output_file = optarg;
           break;
-        
-        case 'r': //remove a color channel
-          if(transformation){
-            fprintf(stderr, "Error: Multiple transformations specified\n");
-            exit(1); 
-          }
-          channel = optarg;
-          if (strcmp(channel, "red") != 0 && strcmp(channel, "green") != 0 && strcmp(channel, "blue") != 0) {
-            fprintf(stderr, "Error: Invalid channel specification: (%s); should be 'red', 'green', or 'blue'\n", channel);
+          
+        case 'S': //stream the image in strips of the given no. of rows
+          strip_rows = atoi(optarg);
+          if (strip_rows < 0) {
+            fprintf(stderr, "Error: Invalid strip height: %d; must be 0 or greater\n", strip_rows);
             exit(1);
           }
-          rem_mode = 1;
-          transformation = 1;
-          break;
-          
-        case 's': //sepia transformation
-          if(transformation){
-            fprintf(stderr, "Error: Multiple transformations specified\n");
-            exit(1); 
+          if (strip_rows == 0) {
+            strip_rows = DEFAULT_STRIP_ROWS;
           }
-          sepia_mode = 1;
-          transformation = 1;
+          stream_mode = 1;
           break;
           
-        case 'm': //mirror the image
-          if(transformation){
-            fprintf(stderr, "Error: Multiple transformations specified\n");
-            exit(1); 
-          }
-          mirr_mode = 1;
-          transformation = 1;
+        case 'B': //batch mode over a manifest or directory
+          batch_source = optarg;
           break;
           
-        case 't': //thumbnail transformation
-          if(transformation){
-            fprintf(stderr, "Error: Multiple transformations specified\n");
-            exit(1); 
-          }
-          
-          scale =  atoi(optarg);
+        case SERVE_OPT: //persistent service on a Unix socket
+          serve_socket = optarg;
+          break;
           
-          if (scale <= 0) {
-            fprintf(stderr, "Error: Invalid scale factor: %d; must be greater than 0\n", scale);
+        case CACHE_OPT: //memory bound of the service's image cache
+          cache_mb = atol(optarg);
+          if (cache_mb < 0) {
+            fprintf(stderr, "Error: Invalid cache size: %s; must be 0 or greater\n", optarg);
             exit(1);
           }
-          
-          tnail_mode = 1;
-          transformation = 1;
           break;
-        
-        case 'n': //tiling thumbnails
-          if(transformation){
-            fprintf(stderr, "Error: Multiple transformations specified\n");
-            exit(1); 
-          }
-          scale =  atoi(optarg);
           
-          if (scale < 1 || scale > 8 ) {
-            fprintf(stderr, "Error: Invalid scale factor: %d; must be 1-8\n", scale);
-            exit(1);
-          }
+        case 'v': //per-phase timings of a whole-image conversion
+          verbose = 1;
+          break;
           
-          tile_mode = 1;
-          transformation = 1;
+        case GENERIC_OPT: //skip the specialized kernels and the in-place paths, to measure what they gain
+          generic_kernels = 1;
           break;
           
-        case 'o': //handling the output option
-          output_file = optarg;
+        case 'j': //no. of batch workers
+          workers = atoi(optarg);
+          if (workers <= 0) {
+            fprintf(stderr, "Error: Invalid worker count: %s; must be greater than 0\n", optarg);
+            exit(1);
+          }
           break;
           
         default: 
@@ -150,6 +175,35 @@ int main( int argc, char *argv[] )
       }//end switch
     } //end while
     
+    //Service mode: transformations arrive as requests on the socket
+    if (serve_socket != NULL) {
+        return serve(serve_socket, (size_t)cache_mb << 20);
+    }
+    
+    if (output_file == NULL) {
+        fprintf(stderr, "Error: No output file specified\n");
+        print_usage();
+    }
+    
+    //Streaming interleaves the phases, and batch mode prints its own per-file table
+    if (verbose && (stream_mode || batch_source != NULL)) {
+        fprintf(stderr, "Error: -v cannot be combined with %s\n", stream_mode ? "-S" : "-B");
+        exit(1);
+    }
+    
+    //Batch mode: many inputs, one output name per input built from a template
+    if (batch_source != NULL) {
+        if (stream_mode) {
+            fprintf(stderr, "Error: -S cannot be combined with -B\n");
+            exit(1);
+        }
+        if (strstr(output_file, "%s") == NULL) {
+            fprintf(stderr, "Error: Batch output template must contain %%s, e.g. out/%%s.pbm\n");
+            exit(1);
+        }
+        return batch_convert(&t, batch_source, output_file, workers);
+    }
+    
     //Handling remaining arguments
     if (optind >= argc) {
         fprintf(stderr, "Error: No input file specified\n");
@@ -158,132 +212,195 @@ int main( int argc, char *argv[] )
         input_file = argv[optind]; 
     }
     
-    if (output_file == NULL) {
-        fprintf(stderr, "Error: No output file specified\n");
-        print_usage();
-    }
-    
-    if (transformation == 0) { //set bitmap transformation as default
-      pbm_mode = 1;
+    //Streaming keeps only one strip in memory, so it only covers row-local transformations
+    if (stream_mode) {
+        if (t.mode == 'n' || t.mode == 'p' || t.mode == 'R') {
+            fprintf(stderr, "Error: %s cannot be streamed; drop -S\n",
+                    t.mode == 'n' ? "Tiling" : t.mode == 'p' ? "A pyramid" : "Resizing");
+            exit(1);
+        }
+        printf("Streaming %s to %s in strips of %d rows\n", input_file, output_file, strip_rows);
+        return stream_convert(&t, input_file, output_file, strip_rows);
     }
 
     
     //Call the transformations
-    if(pbm_mode){
+    if(t.mode == 'b'){
         printf("Converting %s to PBM and saving to %s\n", input_file, output_file);
-        
-        PPMImage *img = read_ppmfile(input_file);
-        PBMImage *pbm = bitmap(img);
-        write_pbmfile(pbm, output_file);
-        del_pbmimage(pbm);
-        del_ppmimage(img);
-        
-    }else if(pgm_mode) {
-        printf("Converting %s to PGM with max grayscale %d and saving to %s\n", input_file, grayscale_max, output_file);
-        
-        PPMImage *img = read_ppmfile(input_file);
-        PGMImage *pgm = grayscale(img, grayscale_max);
-        write_pgmfile(pgm, output_file);
-        del_pgmimage(pgm);
-        del_ppmimage(img);        
-        
-    }else if (iso_mode){
-        printf("Isolating %s channel from %s and saving to %s\n", channel, input_file, output_file);
-        
-        PPMImage *img = read_ppmfile(input_file);
-        PPMImage *new_img = isolate(img, channel);
-        write_ppmfile(new_img, output_file);
-        del_ppmimage(new_img);
-        del_ppmimage(img);
-           
-    }else if(rem_mode){
-        printf("Removing %s channel from %s and saving to %s\n", channel, input_file, output_file);
-        
-        PPMImage *img = read_ppmfile(input_file);
-        PPMImage *new_img = remove_channel(img, channel);
-        write_ppmfile(new_img, output_file);
-        del_ppmimage(new_img);
-        del_ppmimage(img);
-        
-    }else if(sepia_mode) {
+    }else if(t.mode == 'g') {
+        printf("Converting %s to PGM with max grayscale %d and saving to %s\n", input_file, t.value, output_file);
+    }else if (t.mode == 'i'){
+        printf("Isolating %s channel from %s and saving to %s\n", t.channel, input_file, output_file);
+    }else if(t.mode == 'r'){
+        printf("Removing %s channel from %s and saving to %s\n", t.channel, input_file, output_file);
+    }else if(t.mode == 's') {
         printf("Applying sepia transformation to %s and saving to %s\n", input_file, output_file);
-        
-        PPMImage *img = read_ppmfile(input_file);
-        PPMImage *new_img = sepia(img);
-        write_ppmfile(new_img, output_file);
-        del_ppmimage(new_img);
-        del_ppmimage(img);
-        
-    }else if(mirr_mode){
+    }else if(t.mode == 'm'){
         printf("Applying vertical mirror to %s and saving to %s\n", input_file, output_file);
-        
-        PPMImage *img = read_ppmfile(input_file);
-        PPMImage *new_img = mirror(img);
-        write_ppmfile(new_img, output_file);
-        del_ppmimage(new_img);
-        del_ppmimage(img);
-        
-    }else if(tnail_mode) {
-        printf("Reducing %s to a thumbnail with scale factor %d and saving to %s\n", input_file, scale, output_file);
-        
-        PPMImage *img = read_ppmfile(input_file);
-        PPMImage *new_img = thumbnail(img, scale);
-        write_ppmfile(new_img, output_file);
-        del_ppmimage(new_img);
-        del_ppmimage(img);        
-        
-    }else if(tile_mode) {
-        printf("Tiling %s into %d thumbnails and saving to %s\n", input_file, scale, output_file);
-        
-        PPMImage *img = read_ppmfile(input_file);
-        PPMImage *new_img = tile(img, scale);
-        write_ppmfile(new_img, output_file);
-        del_ppmimage(new_img);
-        del_ppmimage(img);
-    }    
+    }else if(t.mode == 't') {
+        printf("Reducing %s to a thumbnail with scale factor %d and saving to %s\n", input_file, t.scale, output_file);
+    }else if(t.mode == 'n') {
+        printf("Tiling %s into %d thumbnails and saving to %s\n", input_file, t.scale, output_file);
+    }else if(t.mode == 'p') {
+        printf("Building a %d-level pyramid of %s and saving to numbered copies of %s\n", t.levels, input_file, output_file);
+    }else if(t.mode == 'R') {
+        printf("Resizing %s to %ux%u with the %s filter and saving to %s\n", input_file, t.width, t.height, resize_filter_name(t.filter), output_file);
+    }
+    
+    double start = now_seconds();
+    double timings[2];
+    PPMImage *img = ppm_load(input_file);
+    if (img == NULL) {
+        exit(1);
+    }
+    double decode = now_seconds() - start;
+    //--generic-kernels also goes through the copying transformations, whose
+    //per-sample loops are the baseline for isolate and remove
+    if (convert_image(&t, img, !generic_kernels, output_file, timings) != 0) {
+        exit(1);
+    }
+    if (verbose) {
+        fprintf(stderr, "Timings: decode %.6f s, transform %.6f s, encode %.6f s, %u x %u\n",
+                decode, timings[0], timings[1], img->width, img->height);
+    }
+    del_ppmimage(img);
     
     return 0;
 }
 
+//Monotonic wall clock in seconds, for timings
+double now_seconds(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Apply the transformation to img and write the result to output_file.
+//With in_place set, same-geometry transformations overwrite img instead of
+//filling a second image; otherwise img is left untouched. If timings is
+//given, it receives the transform and write times in seconds.
+//Returns -1 if the output could not be written.
+int convert_image(const Transform *t, PPMImage *img, int in_place, const char *output_file, double *timings){
+  double start = now_seconds();
+  double mid;
+  int ret = 0;
+  
+  if(in_place && transform_in_place(t, img)){
+    mid = now_seconds();
+    ret = stream_save_ppm(img, output_file);
+  }else if(t->mode == 'b'){
+    PBMImage *pbm = bitmap(img);
+    mid = now_seconds();
+    ret = stream_save_pbm(pbm, output_file);
+    del_pbmimage(pbm);
+  }else if(t->mode == 'g'){
+    PGMImage *pgm = grayscale(img, t->value);
+    mid = now_seconds();
+    ret = stream_save_pgm(pgm, output_file);
+    del_pgmimage(pgm);
+  }else if(t->mode == 'p'){
+    ret = pyramid(img, t->levels, output_file); //writes as it goes
+    mid = now_seconds();
+  }else{
+    PPMImage *new_img;
+    switch(t->mode){
+      case 'i': new_img = isolate(img, t->channel); break;
+      case 'r': new_img = remove_channel(img, t->channel); break;
+      case 's': new_img = sepia(img); break;
+      case 'm': new_img = mirror(img); break;
+      case 't': new_img = thumbnail(img, t->scale); break;
+      case 'R': new_img = resize(img, t->width, t->height, t->filter); break;
+      default:  new_img = tile(img, t->scale); break;
+    }
+    mid = now_seconds();
+    ret = stream_save_ppm(new_img, output_file);
+    del_ppmimage(new_img);
+  }
+  
+  if(timings != NULL){
+    timings[0] = mid - start;
+    timings[1] = now_seconds() - mid;
+  }
+  return ret;
+}
+
 //Implementations for Transformations 
 
 //Convert ppm image to pbm
+//The threshold test is a function of r+g+b, looked up in a table when the image is big enough
 PBMImage* bitmap(PPMImage * p){
   PBMImage *pbm = new_pbmimage(p->width, p->height);
+  SumLUT lut;
+  int use_lut = lut_worthwhile(3 * (size_t)p->max + 1, sizeof(unsigned int), (size_t)p->width * p->height);
+  if(use_lut){
+    lut_sum_build(&lut, p->max, 0, 0);
+  }
     
   for(unsigned int h = 0; h < p->height; h++) {
+     const unsigned int *r = p->pixmap[0][h], *g = p->pixmap[1][h], *b = p->pixmap[2][h];
+     unsigned int *out = pbm->pixmap[h];
      for(unsigned int w = 0; w < p->width; w++) {
-         unsigned int avg = (int)(p->pixmap[0][h][w] + p->pixmap[1][h][w] + p->pixmap[2][h][w]) / 3;
-         if(avg < (int)(p->max/2)){
-            pbm->pixmap[h][w] = 0;
-         }else{
-            pbm->pixmap[h][w] = 1;
-         }
+         unsigned int sum = r[w] + g[w] + b[w];
+         out[w] = (use_lut && sum < lut.entries) ? lut.bit[sum] : bitmap_bit(sum, p->max);
      }
    }
-   return pbm;
+  
+  if(use_lut){
+    lut_sum_free(&lut);
+  }
+  return pbm;
 }
 
 //Convert the ppm image to a pgm 
+//Like bitmap, the gray level only depends on r+g+b, so the divide goes into a table
 PGMImage* grayscale(PPMImage * p, int value){
   PGMImage *pgm = new_pgmimage(p->width, p->height, value);
+  SumLUT lut;
+  int use_lut = lut_worthwhile(3 * (size_t)p->max + 1, sizeof(unsigned int), (size_t)p->width * p->height);
+  if(use_lut){
+    lut_sum_build(&lut, p->max, value, 1);
+  }
 
   for(unsigned int h = 0; h < p->height; h++) {
+    const unsigned int *r = p->pixmap[0][h], *g = p->pixmap[1][h], *b = p->pixmap[2][h];
+    unsigned int *out = pgm->pixmap[h];
     for(unsigned int w = 0; w < p->width; w++) {
-        unsigned int avg = (unsigned int)(p->pixmap[0][h][w] + p->pixmap[1][h][w] 
-                            + p->pixmap[2][h][w])/3;
-        pgm->pixmap[h][w] = (unsigned int)((avg*value)/(p->max));  
+        unsigned int sum = r[w] + g[w] + b[w];
+        out[w] = (use_lut && sum < lut.entries) ? lut.gray[sum] : gray_level(sum, p->max, value);
     }
   }
+  
+  if(use_lut){
+    lut_sum_free(&lut);
+  }
   return pgm;
 
 }
 
+//Copy the channels set in `keep` (bit i for channel i) and zero the rest,
+//deciding once per plane instead of once per sample
+static void select_channels(PPMImage * p, PPMImage * new_p, int keep){
+  size_t row_bytes = p->width * sizeof(unsigned int);
+  for (int i = 0; i < 3; i++) {
+      for (unsigned int h = 0; h < p->height; h++) {
+          if (keep & (1 << i)) {
+              memcpy(new_p->pixmap[i][h], p->pixmap[i][h], row_bytes);
+          } else {
+              memset(new_p->pixmap[i][h], 0, row_bytes);
+          }
+      }
+  }
+}
+
 //Isolate the specified RGB channel
 PPMImage* isolate(PPMImage * p, char* color){
   PPMImage *new_p = new_ppmimage(p->width, p->height, p->max);
   int channel = (strcmp(color, "red") == 0) ? 0 : (strcmp(color, "green") == 0) ? 1 : 2; //WILL REVIEW THIS LATER
 
+  if (!generic_kernels) {
+      select_channels(p, new_p, 1 << channel);
+      return new_p;
+  }
   for (unsigned int h = 0; h < p->height; h++) {
       for (unsigned int w = 0; w < p->width; w++) {
           for (int i = 0; i < 3; i++) {
@@ -301,6 +418,10 @@ PPMImage* remove_channel(PPMImage * p, char* color){
   PPMImage *new_p = new_ppmimage(p->width, p->height, p->max);
   int channel = (strcmp(color, "red") == 0) ? 0 : (strcmp(color, "green") == 0) ? 1 : 2;
  
+  if (!generic_kernels) {
+      select_channels(p, new_p, 7 & ~(1 << channel));
+      return new_p;
+  }
   for (unsigned int h = 0; h < p->height; h++) {
       for (unsigned int w = 0; w < p->width; w++) {
           for (int i = 0; i < 3; i++) {
@@ -312,90 +433,169 @@ PPMImage* remove_channel(PPMImage * p, char* color){
 }
 
 
-//Apply a sepia transformation
-PPMImage* sepia(PPMImage * p){
-  PPMImage *new_p = new_ppmimage(p->width, p->height, p->max);
+//Sepia of every row of p into dst, which may be p itself: a pixel's three
+//samples are read before any of its outputs is stored. With a table, each
+//product is looked up instead of multiplied; the sums are the same doubles
+//added in the same order, so the truncated results match the direct path.
+static void sepia_rows(PPMImage * p, PPMImage * dst){
+  SepiaLUT lut;
+  int use_lut = lut_worthwhile(3 * ((size_t)p->max + 1), 3 * sizeof(double), (size_t)p->width * p->height);
+  if(use_lut){
+    lut_sepia_build(&lut, p->max);
+  }
   
   for (unsigned int h = 0; h < p->height; h++) {
+      const unsigned int *r = p->pixmap[0][h], *g = p->pixmap[1][h], *b = p->pixmap[2][h];
+      unsigned int *out_r = dst->pixmap[0][h], *out_g = dst->pixmap[1][h], *out_b = dst->pixmap[2][h];
       for (unsigned int w = 0; w < p->width; w++) {
-          unsigned int red = p->pixmap[0][h][w];
-          unsigned int green = p->pixmap[1][h][w];
-          unsigned int blue = p->pixmap[2][h][w];
+          unsigned int red = r[w];
+          unsigned int green = g[w];
+          unsigned int blue = b[w];
+          unsigned int tr, tg, tb;
           
-          unsigned int tr = 0.393 * red + 0.769 * green + 0.189 * blue;
-          unsigned int tg = 0.349 * red + 0.686 * green + 0.168 * blue;
-          unsigned int tb = 0.272 * red + 0.534 * green + 0.131 * blue;
+          if (use_lut && ((red | green | blue) & ~lut.mask) == 0) {
+              const double *pr = lut.product[0] + 3 * red;
+              const double *pg = lut.product[1] + 3 * green;
+              const double *pb = lut.product[2] + 3 * blue;
+              tr = pr[0] + pg[0] + pb[0];
+              tg = pr[1] + pg[1] + pb[1];
+              tb = pr[2] + pg[2] + pb[2];
+          } else {
+              tr = sepia_weight[0][0] * red + sepia_weight[0][1] * green + sepia_weight[0][2] * blue;
+              tg = sepia_weight[1][0] * red + sepia_weight[1][1] * green + sepia_weight[1][2] * blue;
+              tb = sepia_weight[2][0] * red + sepia_weight[2][1] * green + sepia_weight[2][2] * blue;
+          }
           
-          new_p->pixmap[0][h][w] = (tr > p->max) ? p->max : (unsigned int)tr;
-          new_p->pixmap[1][h][w] = (tg > p->max) ? p->max : (unsigned int)tg;
-          new_p->pixmap[2][h][w] = (tb > p->max) ? p->max : (unsigned int)tb;
+          out_r[w] = (tr > p->max) ? p->max : tr;
+          out_g[w] = (tg > p->max) ? p->max : tg;
+          out_b[w] = (tb > p->max) ? p->max : tb;
       }
   }
+  
+  if(use_lut){
+    lut_sepia_free(&lut);
+  }
+}
+
+//Apply a sepia transformation
+PPMImage* sepia(PPMImage * p){
+  PPMImage *new_p = new_ppmimage(p->width, p->height, p->max);
+  sepia_rows(p, new_p);
   return new_p;
 
 }
 
-//Vertically mirror the first half of the image to the second half
+//Vertically mirror the first half of the image to the second half.
+//Copies the image and mirrors the copy, so the middle column of an odd width
+//is kept exactly as mirror_in_place keeps it.
 PPMImage* mirror(PPMImage * p){ 
   PPMImage *new_p = new_ppmimage(p->width, p->height, p->max);
+  size_t row_bytes = p->width * sizeof(unsigned int);
   
-  // Copy first half of the image
+  for (int i = 0; i < 3; i++) {
+      for (unsigned int h = 0; h < p->height; h++) {
+          memcpy(new_p->pixmap[i][h], p->pixmap[i][h], row_bytes);
+      }
+  }
+  mirror_in_place(new_p);
+  return new_p;
+
+}
+
+//In-place variants of the four transformations above. The output has the
+//input's geometry, so the decoded planes are rewritten where they are and
+//no second image is allocated.
+
+//Zero every channel but the one to keep
+void isolate_in_place(PPMImage * p, char* color){
+  int channel = (strcmp(color, "red") == 0) ? 0 : (strcmp(color, "green") == 0) ? 1 : 2;
+  size_t row_bytes = p->width * sizeof(unsigned int);
+
+  for (int i = 0; i < 3; i++) {
+      if (i == channel) {
+          continue;
+      }
+      for (unsigned int h = 0; h < p->height; h++) {
+          memset(p->pixmap[i][h], 0, row_bytes);
+      }
+  }
+}
+
+//Zero the one channel to drop
+void remove_channel_in_place(PPMImage * p, char* color){
+  int channel = (strcmp(color, "red") == 0) ? 0 : (strcmp(color, "green") == 0) ? 1 : 2;
+  size_t row_bytes = p->width * sizeof(unsigned int);
+
   for (unsigned int h = 0; h < p->height; h++) {
-      for (unsigned int w = 0; w < p->width / 2; w++) {
-          for (int i = 0; i < 3; i++) {
-              new_p->pixmap[i][h][w] = p->pixmap[i][h][w];
-              new_p->pixmap[i][h][p->width - w- 1] = p->pixmap[i][h][w];  // Mirror vertically
+      memset(p->pixmap[channel][h], 0, row_bytes);
+  }
+}
+
+void sepia_in_place(PPMImage * p){
+  sepia_rows(p, p);
+}
+
+//Only the right half is written, and only from the left half, so no source
+//sample is overwritten before it is read. The middle column of an odd width
+//keeps its own value.
+void mirror_in_place(PPMImage * p){
+  for (int i = 0; i < 3; i++) {
+      for (unsigned int h = 0; h < p->height; h++) {
+          unsigned int *row = p->pixmap[i][h];
+          for (unsigned int w = 0; w < p->width / 2; w++) {
+              row[p->width - w - 1] = row[w];
           }
       }
   }
-  return new_p;
+}
 
+//Apply t to p in place if its output has p's geometry; returns 0, leaving p
+//untouched, for the transformations that need a new image
+int transform_in_place(const Transform *t, PPMImage *p){
+  switch(t->mode){
+    case 'i': isolate_in_place(p, t->channel); return 1;
+    case 'r': remove_channel_in_place(p, t->channel); return 1;
+    case 's': sepia_in_place(p); return 1;
+    case 'm': mirror_in_place(p); return 1;
+    default:  return 0;
+  }
 }
 
 //Reduce image to a thumbnail based on scale given
+//The averaging runs in a kernel picked for the scale and sample depth (kernels.c)
 PPMImage* thumbnail(PPMImage * p, int scale){
   unsigned int new_width = p->width / scale;
   unsigned int new_height = p->height / scale;
   PPMImage *new_p = new_ppmimage(new_width, new_height, p->max);
   
-  for (unsigned int h = 0; h < new_height; h++) {
-      for (unsigned int w = 0; w < new_width; w++) {
-          for (int i = 0; i < 3; i++) {
-              // Average over scale x scale block
-              unsigned int sum = 0;
-              for (unsigned int y = 0; y < scale; y++) {
-                  for (unsigned int x = 0; x < scale; x++) {
-                      sum += p->pixmap[i][h*scale + y][w*scale + x];
-                  }
-              }
-              new_p->pixmap[i][h][w] = (unsigned int)sum / (scale * scale);  // Average pixel
-          }
-      }
-  }
+  thumbnail_kernel(scale, p->max)(p, new_p, scale);
   return new_p;
 }
 
 //Tile thumbnails based on scale given
+//The output is scale x scale thumbnails; each row is built once and replicated with memcpy
 PPMImage* tile(PPMImage * p, int scale){
-  unsigned int thumb_width = p->width / scale;
-  unsigned int thumb_height = p->height / scale;
-  unsigned int new_width = p->width * scale;
-  unsigned int new_height = p->height * scale;
-  
-  PPMImage *new_p = new_ppmimage(new_width, new_height, p->max);
-  
   // Create thumbnails
   PPMImage *thumb = thumbnail(p, scale);
   
-  // Tile the thumbnails
-  for (unsigned int y = 0; y < scale; y++) {
-      for (unsigned int x = 0; x < scale; x++) {
-          for (unsigned int h = 0; h < thumb_height; h++) {
-              for (unsigned int w = 0; w < thumb_width; w++) {
-                  for (int i = 0; i < 3; i++) {
-                      new_p->pixmap[i][y*thumb_height + h][x*thumb_width + w] = thumb->pixmap[i][h][w];
-                  }
-              }
+  unsigned int thumb_width = thumb->width;
+  unsigned int thumb_height = thumb->height;
+  unsigned int new_width = thumb_width * scale;
+  unsigned int new_height = thumb_height * scale;
+  size_t thumb_row = thumb_width * sizeof(unsigned int);
+  size_t new_row = new_width * sizeof(unsigned int);
+  
+  PPMImage *new_p = new_ppmimage(new_width, new_height, p->max);
+  
+  // Tile the thumbnails: fill the first band of tiles, then copy it down
+  for (int i = 0; i < 3; i++) {
+      for (unsigned int h = 0; h < thumb_height; h++) {
+          unsigned int *dst = new_p->pixmap[i][h];
+          for (int x = 0; x < scale; x++) {
+              memcpy(dst + x*thumb_width, thumb->pixmap[i][h], thumb_row);
+          }
+          for (int y = 1; y < scale; y++) {
+              memcpy(new_p->pixmap[i][y*thumb_height + h], dst, new_row);
           }
       }
   }
@@ -404,3 +604,149 @@ PPMImage* tile(PPMImage * p, int scale){
   return new_p;
 
 }
+
+
+//Name of pyramid level `level`: out.ppm -> out_1.ppm, out_2.ppm, ...
+static void level_filename(const char *output_file, int level, char *name, size_t len){
+  const char *slash = strrchr(output_file, '/');
+  const char *dot = strrchr(output_file, '.');
+  
+  if(dot == NULL || (slash != NULL && dot < slash) || dot == output_file || dot == slash + 1){
+    snprintf(name, len, "%s_%d", output_file, level);
+  }else{
+    snprintf(name, len, "%.*s_%d%s", (int)(dot - output_file), output_file, level, dot);
+  }
+}
+
+//Write `levels` 2x box-downsampled copies of the image; level n has scale 2^n.
+//Each level is derived from the one before it, so the whole pyramid costs
+//about 1/3 of a pass over the input on top of the decode.
+//Returns -1 if a level could not be written; the levels after it are skipped.
+int pyramid(PPMImage * p, int levels, const char *output_file){
+  char name[4096];
+  PPMImage *prev = p;
+  int ret = 0;
+  
+  for (int level = 1; level <= levels; level++) {
+      if (prev->width < 2 || prev->height < 2) {
+          fprintf(stderr, "Warning: Image too small for level %d; stopping at level %d\n", level, level - 1);
+          break;
+      }
+      PPMImage *next = thumbnail(prev, 2);
+      
+      level_filename(output_file, level, name, sizeof(name));
+      ret = stream_save_ppm(next, name);
+      
+      if (prev != p) {
+          del_ppmimage(prev);
+      }
+      prev = next;
+      if (ret != 0) {
+          break;
+      }
+  }
+  
+  if (prev != p) {
+      del_ppmimage(prev);
+  }
+  return ret;
+}
+
+//Same as convert_image, but write the result to an open stream.
+//Returns -1 for the pyramid, which needs an output file name.
+int convert_image_to(const Transform *t, PPMImage *img, int in_place, FILE *fp){
+  if(in_place && transform_in_place(t, img)){
+    stream_write_ppm_header(fp, img->width, img->height, img->max);
+    stream_write_ppm_rows(fp, img);
+  }else if(t->mode == 'b'){
+    PBMImage *pbm = bitmap(img);
+    stream_write_pbm_header(fp, pbm->width, pbm->height);
+    stream_write_pbm_rows(fp, pbm);
+    del_pbmimage(pbm);
+  }else if(t->mode == 'g'){
+    PGMImage *pgm = grayscale(img, t->value);
+    stream_write_pgm_header(fp, pgm->width, pgm->height, pgm->max);
+    stream_write_pgm_rows(fp, pgm);
+    del_pgmimage(pgm);
+  }else if(t->mode == 'p'){
+    return -1;
+  }else{
+    PPMImage *new_img;
+    switch(t->mode){
+      case 'i': new_img = isolate(img, t->channel); break;
+      case 'r': new_img = remove_channel(img, t->channel); break;
+      case 's': new_img = sepia(img); break;
+      case 'm': new_img = mirror(img); break;
+      case 't': new_img = thumbnail(img, t->scale); break;
+      case 'R': new_img = resize(img, t->width, t->height, t->filter); break;
+      default:  new_img = tile(img, t->scale); break;
+    }
+    stream_write_ppm_header(fp, new_img->width, new_img->height, new_img->max);
+    stream_write_ppm_rows(fp, new_img);
+    del_ppmimage(new_img);
+  }
+  return 0;
+}
+
+//Convert an image strip by strip so peak memory is O(width x strip_rows)
+int stream_convert(const Transform *t, const char *input_file, const char *output_file, unsigned int strip_rows){
+  char mode = t->mode;
+  int scale = t->scale;
+  PPMReader reader;
+  if(ppm_reader_open(&reader, input_file) != 0){
+    exit(1);
+  }
+  
+  unsigned int out_width = reader.width;
+  unsigned int out_height = reader.height;
+  if(mode == 't'){
+    // Round strips up to whole scale x scale blocks so no block straddles two strips
+    strip_rows = ((strip_rows + scale - 1) / scale) * scale;
+    out_width /= scale;
+    out_height /= scale;
+  }
+  if(strip_rows > reader.height){
+    strip_rows = reader.height;
+  }
+  
+  PPMImage *strip = new_ppmimage(reader.width, strip_rows, reader.max);
+  FILE *out = stream_open_output(output_file);
+  
+  if(mode == 'b'){
+    stream_write_pbm_header(out, out_width, out_height);
+  }else if(mode == 'g'){
+    stream_write_pgm_header(out, out_width, out_height, t->value);
+  }else{
+    stream_write_ppm_header(out, out_width, out_height, reader.max);
+  }
+  
+  unsigned int rows;
+  while((rows = ppm_reader_read_strip(&reader, strip, strip_rows)) > 0){
+    strip->height = rows; // the last strip may be short
+    
+    if(transform_in_place(t, strip)){
+      stream_write_ppm_rows(out, strip); // the strip is refilled by the next read
+    }else if(mode == 'b'){
+      PBMImage *pbm = bitmap(strip);
+      stream_write_pbm_rows(out, pbm);
+      del_pbmimage(pbm);
+    }else if(mode == 'g'){
+      PGMImage *pgm = grayscale(strip, t->value);
+      stream_write_pgm_rows(out, pgm);
+      del_pgmimage(pgm);
+    }else{
+      PPMImage *new_strip = thumbnail(strip, scale);
+      stream_write_ppm_rows(out, new_strip);
+      del_ppmimage(new_strip);
+    }
+    
+    strip->height = strip_rows;
+  }
+  
+  del_ppmimage(strip);
+  ppm_reader_close(&reader);
+  if(stream_close_output(out) != 0 || reader.error){
+    return 1;
+  }
+  return 0;
+}
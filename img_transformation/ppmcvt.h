@@ -0,0 +1,76 @@
+/*
+Declarations shared between ppmcvt.c, pbm_aux.c and the batch and service drivers
+*/
+#ifndef PPMCVT_H
+#define PPMCVT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "pbm.h"
+
+#define MAX_PYRAMID_LEVELS 16
+#define MAX_RESIZE_DIM 65536   // largest width or height -R accepts
+#define DEFAULT_CACHE_MB 512   // decoded-image cache of the service
+
+// Resize filters (resize.c)
+#define FILTER_BOX      0
+#define FILTER_BILINEAR 1
+#define FILTER_LANCZOS  2
+
+// Long-only options
+#define SERVE_OPT 256
+#define CACHE_OPT 257
+#define GENERIC_OPT 258
+
+// The transformation picked on the command line, applied to every input image
+typedef struct {
+    char mode;          // option letter: b, g, i, r, s, m, t, n, p or R
+    char *channel;      // color channel for isolate and remove
+    int value;          // max grayscale value
+    int scale;          // scale factor for thumbnail and tile
+    int levels;         // number of pyramid levels
+    unsigned int width, height;  // target size for resize
+    int filter;         // resize filter
+} Transform;
+
+//Decalring transfromation functions
+PBMImage* bitmap(PPMImage *p);
+PGMImage* grayscale(PPMImage * p, int value);
+PPMImage* isolate(PPMImage * p, char* color);
+PPMImage* remove_channel(PPMImage * p, char* color);
+PPMImage* sepia(PPMImage * p);
+PPMImage* mirror(PPMImage * p);
+PPMImage* thumbnail(PPMImage * p, int scale);
+PPMImage* tile(PPMImage * p, int scale);
+int pyramid(PPMImage * p, int levels, const char *output_file);
+PPMImage* resize(PPMImage * p, unsigned int width, unsigned int height, int filter);
+int resize_filter_parse(const char *name);
+const char *resize_filter_name(int filter);
+
+// Same-geometry transformations applied to the decoded image itself
+void isolate_in_place(PPMImage * p, char* color);
+void remove_channel_in_place(PPMImage * p, char* color);
+void sepia_in_place(PPMImage * p);
+void mirror_in_place(PPMImage * p);
+int transform_in_place(const Transform *t, PPMImage *p);
+
+// Specialized kernels (kernels.c); generic_kernels forces the runtime-parameter ones
+typedef void (*ThumbnailKernel)(PPMImage *p, PPMImage *new_p, int scale);
+extern int generic_kernels;
+ThumbnailKernel thumbnail_kernel(int scale, unsigned int max);
+
+// Drivers
+double now_seconds(void);
+int set_transform(Transform *t, int opt, char *arg, char *err, size_t errlen);
+int convert_image(const Transform *t, PPMImage *img, int in_place, const char *output_file, double *timings);
+int convert_image_to(const Transform *t, PPMImage *img, int in_place, FILE *fp);
+int stream_convert(const Transform *t, const char *input_file, const char *output_file, unsigned int strip_rows);
+int batch_convert(const Transform *t, const char *source, const char *out_template, int workers);
+int serve(const char *socket_path, size_t cache_bytes);
+
+// Size-classed buffer pool behind new_*image/del_*image (pbm_aux.c).
+// Must be enabled before the first image is allocated.
+void pbm_pool_enable(size_t limit_bytes);
+void pbm_pool_stats(unsigned long *reused, unsigned long *allocated);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+Synthetic test image generator for benchmarking ppmcvt.
+The picture is a pair of gradients with a soft diagonal band and some
+noise, so every channel varies across the frame and no transformation
+gets away with constant rows. P3 output uses the same layout as ppmcvt's
+writers (one image row per line); P6 uses 2-byte samples when max > 255.
+
+  ppmgen [-w width] [-h height] [-m maxval] [-f 3|6] [-r seed] > image.ppm
+*/
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+//xorshift64, so the same options always give the same image
+static unsigned long long next_random(void){
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+//Sample of channel c at (x, y), in 0..max
+static unsigned int sample(unsigned int x, unsigned int y, int c, unsigned int w, unsigned int h, unsigned int max){
+  double fx = w > 1 ? (double)x / (w - 1) : 0;
+  double fy = h > 1 ? (double)y / (h - 1) : 0;
+  double band = 1.0 - 2.0 * ((fx + fy) / 2 > 0.5 ? (fx + fy) / 2 - 0.5 : 0.5 - (fx + fy) / 2);
+  double v;
+
+  switch(c){
+    case 0:  v = 0.7 * fx + 0.3 * band; break;
+    case 1:  v = 0.7 * fy + 0.3 * band; break;
+    default: v = 0.5 * (1 - fx) + 0.5 * band; break;
+  }
+  v += ((double)(next_random() >> 11) / 9007199254740992.0 - 0.5) * 0.1;  // +-5% noise
+
+  if(v < 0){
+    v = 0;
+  }else if(v > 1){
+    v = 1;
+  }
+  return (unsigned int)(v * max + 0.5);
+}
+
+int main(int argc, char *argv[]){
+  int opt;
+  long width = 1920, height = 1080, max = 255;
+  int format = 6;
+
+  while((opt = getopt(argc, argv, "w:h:m:f:r:")) != -1){
+    switch(opt){
+      case 'w':
+        width = atol(optarg);
+        break;
+      case 'h':
+        height = atol(optarg);
+        break;
+      case 'm':
+        max = atol(optarg);
+        break;
+      case 'f':
+        format = atoi(optarg);
+        break;
+      case 'r':
+        rng_state = strtoull(optarg, NULL, 10) | 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: ppmgen [-w width] [-h height] [-m maxval] [-f 3|6] [-r seed]\n");
+        exit(1);
+    }
+  }
+  if(width <= 0 || height <= 0 || max <= 0 || max > 65535 || (format != 3 && format != 6)){
+    fprintf(stderr, "Invalid generator parameters\n");
+    exit(1);
+  }
+
+  unsigned int w = (unsigned int)width, h = (unsigned int)height, m = (unsigned int)max;
+  int bytes = m > 255 ? 2 : 1;
+  unsigned char *raw = (unsigned char *)malloc((size_t)w * 3 * bytes);
+  if(raw == NULL){
+    perror("malloc");
+    exit(1);
+  }
+
+  printf("P%d\n%u %u\n%u\n", format, w, h, m);
+  for(unsigned int y = 0; y < h; y++){
+    unsigned char *out = raw;
+    for(unsigned int x = 0; x < w; x++){
+      for(int c = 0; c < 3; c++){
+        unsigned int v = sample(x, y, c, w, h, m);
+        if(format == 3){
+          printf((x || c) ? " %u" : "%u", v);
+        }else{
+          if(bytes == 2){
+            *out++ = (unsigned char)(v >> 8);
+          }
+          *out++ = (unsigned char)v;
+        }
+      }
+    }
+    if(format == 3){
+      putchar('\n');
+    }else{
+      fwrite(raw, 1, (size_t)w * 3 * bytes, stdout);
+    }
+  }
+
+  free(raw);
+  return ferror(stdout) ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pbm.h"
+#include "ppmcvt.h"
+
+/*
+Resampling to an exact size (-R WxH[:filter]) with a box, bilinear or
+Lanczos-3 filter. The filter is separable, so the image is resized in two
+passes: every row to the new width into a float buffer, then every column
+to the new height. The taps and weights of each output column and row are
+computed once into a table. Both passes work four floats at a time with
+GCC vector types. The horizontal pass takes dot products of four taps at
+once against a float copy of the source row. The vertical pass adds whole
+weighted rows, four output samples at a time. Both passes are split across
+threads by rows.
+*/
+
+#define MIN_ROWS_PER_THREAD 64  // smaller bands are not worth a thread
+#define MAX_RESIZE_THREADS 64
+#define LANES 4                 // floats per vector
+
+typedef float v4f __attribute__((vector_size(LANES * sizeof(float))));
+
+// Which source samples feed each output sample, and with what weight
+typedef struct {
+    int *first;         // first source index, per output index
+    int *count;         // taps actually used, per output index
+    float *weights;     // `stride` weights per output index, zero past `count`
+    int stride;         // a multiple of LANES
+} WeightTable;
+
+// State shared by the threads of one resize
+typedef struct {
+    PPMImage *src, *dst;
+    float *tmp[3];      // src->height rows of dst->width samples per channel, plus LANES of slack
+    WeightTable horizontal, vertical;
+} ResizeJob;
+
+// One thread's band of rows in one pass
+typedef struct {
+    ResizeJob *job;
+    unsigned int begin, end;
+} ResizeBand;
+
+static const char *filter_names[] = {"box", "bilinear", "lanczos"};
+
+static inline v4f load4(const float *p){
+  v4f v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void store4(float *p, v4f v){
+  memcpy(p, &v, sizeof(v));
+}
+
+//Round n up to a whole number of vectors
+static size_t lanes_up(size_t n){
+  return (n + LANES - 1) / LANES * LANES;
+}
+
+//Filter index for a name, -1 if unknown
+int resize_filter_parse(const char *name){
+  for(int f = 0; f < (int)(sizeof(filter_names) / sizeof(filter_names[0])); f++){
+    if(strcmp(name, filter_names[f]) == 0){
+      return f;
+    }
+  }
+  return -1;
+}
+
+const char *resize_filter_name(int filter){
+  return filter_names[filter];
+}
+
+static double sinc(double x){
+  if(x == 0.0){
+    return 1.0;
+  }
+  x *= M_PI;
+  return sin(x) / x;
+}
+
+//Kernel value at x, in units of source samples at scale 1
+static double filter_value(int filter, double x){
+  switch(filter){
+    case FILTER_BOX:
+      return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+    case FILTER_BILINEAR:
+      x = fabs(x);
+      return x < 1.0 ? 1.0 - x : 0.0;
+    default:
+      return (x > -3.0 && x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+  }
+}
+
+static double filter_support(int filter){
+  return filter == FILTER_BOX ? 0.5 : filter == FILTER_BILINEAR ? 1.0 : 3.0;
+}
+
+//Weights mapping in_size samples onto out_size. When shrinking, the kernel
+//is stretched by the scale so every source sample contributes.
+static void build_weights(WeightTable *t, int filter, unsigned int in_size, unsigned int out_size){
+  double scale = (double)in_size / out_size;
+  double stretch = scale > 1.0 ? scale : 1.0;
+  double support = filter_support(filter) * stretch;
+
+  t->stride = (int)lanes_up(2 * (int)ceil(support) + 1);
+  t->first = (int *)malloc(out_size * sizeof(int));
+  t->count = (int *)malloc(out_size * sizeof(int));
+  t->weights = (float *)calloc((size_t)out_size * t->stride, sizeof(float));
+  if(t->first == NULL || t->count == NULL || t->weights == NULL){
+    perror("Failed to allocate memory for resize weights");
+    exit(EXIT_FAILURE);
+  }
+
+  for(unsigned int i = 0; i < out_size; i++){
+    double center = (i + 0.5) * scale;
+    int lo = (int)floor(center - support + 0.5);
+    int hi = (int)floor(center + support + 0.5);
+    if(lo < 0){
+      lo = 0;
+    }
+    if(hi > (int)in_size){
+      hi = in_size;
+    }
+    if(hi - lo > t->stride){
+      hi = lo + t->stride;
+    }
+
+    float *w = t->weights + (size_t)i * t->stride;
+    double total = 0.0;
+    for(int k = 0; k < hi - lo; k++){
+      w[k] = (float)filter_value(filter, (lo + k + 0.5 - center) / stretch);
+      total += w[k];
+    }
+    //Renormalize: near the edges part of the kernel falls outside the image
+    if(total != 0.0){
+      for(int k = 0; k < hi - lo; k++){
+        w[k] = (float)(w[k] / total);
+      }
+    }
+    t->first[i] = lo;
+    t->count[i] = hi - lo;
+  }
+}
+
+static void free_weights(WeightTable *t){
+  free(t->first);
+  free(t->count);
+  free(t->weights);
+}
+
+//Rows begin..end of the source, resampled to the new width
+static void *horizontal_pass(void *arg){
+  ResizeBand *band = (ResizeBand *)arg;
+  ResizeJob *job = band->job;
+  const WeightTable *t = &job->horizontal;
+  unsigned int in_width = job->src->width;
+  unsigned int out_width = job->dst->width;
+
+  //Taps are summed a vector at a time, which can run up to LANES - 1 past
+  //the row; their weights are zero, and so is the slack after the row
+  float *line = (float *)calloc(in_width + LANES, sizeof(float));
+  if(line == NULL){
+    perror("Failed to allocate memory for resize row");
+    exit(EXIT_FAILURE);
+  }
+
+  for(int c = 0; c < 3; c++){
+    for(unsigned int y = band->begin; y < band->end; y++){
+      const unsigned int *src = job->src->pixmap[c][y];
+      for(unsigned int x = 0; x < in_width; x++){
+        line[x] = (float)src[x];
+      }
+
+      float *out = job->tmp[c] + (size_t)y * out_width;
+      for(unsigned int x = 0; x < out_width; x++){
+        const float *s = line + t->first[x];
+        const float *w = t->weights + (size_t)x * t->stride;
+        v4f acc = {0, 0, 0, 0};
+        for(int k = 0; k < t->count[x]; k += LANES){
+          acc += load4(w + k) * load4(s + k);
+        }
+        out[x] = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+      }
+    }
+  }
+
+  free(line);
+  return NULL;
+}
+
+//Output rows begin..end, each a weighted sum of whole rows of the horizontal pass
+static void *vertical_pass(void *arg){
+  ResizeBand *band = (ResizeBand *)arg;
+  ResizeJob *job = band->job;
+  const WeightTable *t = &job->vertical;
+  unsigned int width = job->dst->width;
+  float max = (float)job->dst->max;
+
+  size_t span = lanes_up(width);  // reads past the row end land in the next row or the slack
+  float *acc = (float *)malloc(span * sizeof(float));
+  if(acc == NULL){
+    perror("Failed to allocate memory for resize accumulators");
+    exit(EXIT_FAILURE);
+  }
+
+  for(int c = 0; c < 3; c++){
+    for(unsigned int y = band->begin; y < band->end; y++){
+      const float *w = t->weights + (size_t)y * t->stride;
+      const float *row = job->tmp[c] + (size_t)t->first[y] * width;
+      memset(acc, 0, span * sizeof(float));
+      for(int k = 0; k < t->count[y]; k++){
+        v4f wk = {w[k], w[k], w[k], w[k]};
+        for(size_t x = 0; x < span; x += LANES){
+          store4(acc + x, load4(acc + x) + wk * load4(row + x));
+        }
+        row += width;
+      }
+
+      //Lanczos lobes can overshoot, so clamp while rounding
+      unsigned int *out = job->dst->pixmap[c][y];
+      for(unsigned int x = 0; x < width; x++){
+        float v = acc[x] + 0.5f;
+        out[x] = v <= 0.0f ? 0 : v >= max ? (unsigned int)max : (unsigned int)v;
+      }
+    }
+  }
+
+  free(acc);
+  return NULL;
+}
+
+//Run a pass over rows 0..rows, in bands on up to one thread per CPU
+static void run_pass(ResizeJob *job, void *(*pass)(void *), unsigned int rows){
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int threads = rows / MIN_ROWS_PER_THREAD;
+  if(cpus > 0 && threads > (unsigned int)cpus){
+    threads = cpus;
+  }
+  if(threads > MAX_RESIZE_THREADS){
+    threads = MAX_RESIZE_THREADS;
+  }
+  if(threads <= 1){
+    ResizeBand band = {job, 0, rows};
+    pass(&band);
+    return;
+  }
+
+  pthread_t tids[MAX_RESIZE_THREADS];
+  ResizeBand bands[MAX_RESIZE_THREADS];
+  for(unsigned int i = 0; i < threads; i++){
+    bands[i].job = job;
+    bands[i].begin = (unsigned int)((unsigned long long)rows * i / threads);
+    bands[i].end = (unsigned int)((unsigned long long)rows * (i + 1) / threads);
+    if(pthread_create(&tids[i], NULL, pass, &bands[i]) != 0){
+      perror("Failed to start resize thread");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for(unsigned int i = 0; i < threads; i++){
+    pthread_join(tids[i], NULL);
+  }
+}
+
+//Resample the image to exactly width x height with the given filter
+PPMImage* resize(PPMImage * p, unsigned int width, unsigned int height, int filter){
+  PPMImage *new_p = new_ppmimage(width, height, p->max);
+  if(p->width == 0 || p->height == 0){
+    for(int c = 0; c < 3; c++){
+      for(unsigned int y = 0; y < height; y++){
+        memset(new_p->pixmap[c][y], 0, width * sizeof(unsigned int));
+      }
+    }
+    return new_p;
+  }
+
+  ResizeJob job;
+  job.src = p;
+  job.dst = new_p;
+  build_weights(&job.horizontal, filter, p->width, width);
+  build_weights(&job.vertical, filter, p->height, height);
+  for(int c = 0; c < 3; c++){
+    job.tmp[c] = (float *)calloc((size_t)width * p->height + LANES, sizeof(float));
+    if(job.tmp[c] == NULL){
+      perror("Failed to allocate memory for resize buffer");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  run_pass(&job, horizontal_pass, p->height);
+  run_pass(&job, vertical_pass, height);
+
+  for(int c = 0; c < 3; c++){
+    free(job.tmp[c]);
+  }
+  free_weights(&job.horizontal);
+  free_weights(&job.vertical);
+  return new_p;
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Benchmark pipesort on a synthetic Zipfian corpus and print words/sec per mode as CSV.
+# Corpus shape comes from BENCH_WORDS, BENCH_VOCAB and BENCH_LINE (see the makefile).
+
+WORDS=${BENCH_WORDS:-2000000}
+VOCAB=${BENCH_VOCAB:-50000}
+LINE=${BENCH_LINE:-12}
+CORPUS=bench_corpus.txt
+INPUT=$CORPUS
+
+./zipfgen -w "$WORDS" -v "$VOCAB" -l "$LINE" > "$CORPUS" || exit 1
+
+echo "mode,words_emitted,unique_words,total_s,pipe_write_s,sort_wait_s,words_per_sec"
+
+# One benchmark run: label, then pipesort options
+run() {
+    label=$1
+    shift
+    stats=$(./pipesort --stats=json "$@" < "$INPUT" 2>&1 >/dev/null)
+    field() {
+        echo "$stats" | sed -n "s/.*\"$1\": \([0-9.]*\).*/\1/p"
+    }
+    echo "$label,$(field words_emitted),$(field unique_words),$(field total_s),$(field pipe_write_s),$(field sort_wait_s),$(field words_per_sec)"
+}
+
+run default
+run short3 -s 3
+run long6 -l 6
+run short3_long8 -s 3 -l 8
+run utf8_ascii_corpus -u
+run no_readahead -R
+run hash_words -g 1
+run bigrams -g 2
+run trigrams -g 3
+
+# Same corpus gzipped, inflated by the read-ahead thread
+gzip -c "$CORPUS" > "$CORPUS.gz" || exit 1
+INPUT=$CORPUS.gz
+run gzip_input
+INPUT=$CORPUS
+
+# Same corpus shape with accented words, ASCII tokenizer against -u
+./zipfgen -u -w "$WORDS" -v "$VOCAB" -l "$LINE" > "$CORPUS" || exit 1
+run accented_ascii
+run accented_utf8 -u
+
+rm -f "$CORPUS" "$CORPUS.gz"
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Generate utf8_tables.h for pipesort's UTF-8 tokenizer.
+
+Word characters are the code points in categories L*, M* and Nd.
+Case folding is the Unicode simple folding (CaseFolding.txt status C+S),
+derived from Python's unicodedata: the full folding when it is a single
+character, otherwise the simple lowercase mapping.
+
+    python3 gen_utf8_tables.py > utf8_tables.h
+"""
+import sys
+import unicodedata
+
+
+def is_word(cp):
+    return unicodedata.category(chr(cp))[0] in "LM" or unicodedata.category(chr(cp)) == "Nd"
+
+
+def simple_fold(cp):
+    c = chr(cp)
+    folded = c.casefold()
+    if len(folded) == 1:
+        return ord(folded)
+    lower = c.lower()
+    if len(lower) == 1:
+        return ord(lower)
+    return cp
+
+
+def main():
+    out = sys.stdout
+    # Non-ASCII word ranges [lo, hi]
+    ranges = []
+    for cp in range(0x80, 0x110000):
+        if 0xD800 <= cp <= 0xDFFF or not is_word(cp):
+            continue
+        if ranges and ranges[-1][1] == cp - 1:
+            ranges[-1][1] = cp
+        else:
+            ranges.append([cp, cp])
+
+    # Non-ASCII folds as runs of (lo, hi, delta, stride)
+    folds = []
+    for cp in range(0x80, 0x110000):
+        if 0xD800 <= cp <= 0xDFFF:
+            continue
+        f = simple_fold(cp)
+        if f == cp:
+            continue
+        delta = f - cp
+        if folds:
+            lo, hi, d, stride = folds[-1]
+            if d == delta and (stride == 0 or cp - hi == stride) and cp - hi <= 2:
+                folds[-1] = [lo, cp, d, cp - hi]
+                continue
+        folds.append([cp, cp, delta, 0])
+
+    out.write("/*\nGenerated by gen_utf8_tables.py from Unicode %s; do not edit.\n*/\n"
+              % unicodedata.unidata_version)
+    out.write("#ifndef UTF8_TABLES_H\n#define UTF8_TABLES_H\n\n")
+    out.write("// Non-ASCII word characters (letters, marks, decimal digits) as [lo, hi] ranges\n")
+    out.write("static const unsigned int utf8_word_ranges[][2] = {\n")
+    for lo, hi in ranges:
+        out.write("    {0x%04X, 0x%04X},\n" % (lo, hi))
+    out.write("};\n\n")
+    out.write("// Simple case folding: code points lo, lo+stride, ... hi map to cp + delta\n")
+    out.write("static const struct { unsigned int lo, hi; int delta; unsigned int stride; } utf8_fold_runs[] = {\n")
+    for lo, hi, delta, stride in folds:
+        out.write("    {0x%04X, 0x%04X, %d, %d},\n" % (lo, hi, delta, stride if stride else 1))
+    out.write("};\n\n#endif\n")
+
+
+if __name__ == "__main__":
+    main()
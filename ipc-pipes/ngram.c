@@ -0,0 +1,338 @@
+#include "ngram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+#define HASH_BASE 0x100000001B3ULL  // multiplier of the rolling hash
+#define INITIAL_BITS 12
+
+// Hash table slot; the hash is kept beside the index so most probes touch only the table
+typedef struct {
+    unsigned long long hash;
+    unsigned long long index;  // id or entry + 1, 0 for an empty slot
+} Slot;
+
+struct NgramCounter {
+    int n;
+
+    // Interned words: text in one pool, looked up through an open-addressed table of ids
+    char *pool;
+    size_t pool_len, pool_cap;
+    size_t *word_offset;          // by id
+    unsigned *word_len;
+    unsigned nwords, words_cap;
+    Slot *word_slots;
+    int word_bits;
+
+    // Distinct n-grams: N ids each and a count
+    unsigned *ids;
+    unsigned long long *counts;
+    unsigned long long entries, entries_cap;
+    Slot *slots;
+    int slot_bits;
+
+    // The last N word ids as a ring, and their rolling hash
+    unsigned window[MAX_NGRAM];
+    int start, filled;
+    unsigned long long hash;
+    unsigned long long top_power;  // HASH_BASE^(N-1), to take the oldest id out of the hash
+};
+
+static void *grow(void *p, size_t size) {
+    p = realloc(p, size);
+    if (p == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static void *zeroed(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    return p;
+}
+
+// Spread a hash over the table; the top bits of a multiplicative hash are the well-mixed ones
+static size_t slot_of(unsigned long long h, int bits) {
+    return (size_t)((h * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+NgramCounter *ngram_create(int n) {
+    NgramCounter *c = (NgramCounter *)zeroed(1, sizeof(NgramCounter));
+    c->n = n;
+    c->word_bits = INITIAL_BITS;
+    c->word_slots = (Slot *)zeroed((size_t)1 << c->word_bits, sizeof(Slot));
+    c->slot_bits = INITIAL_BITS;
+    c->slots = (Slot *)zeroed((size_t)1 << c->slot_bits, sizeof(Slot));
+    c->top_power = 1;
+    for (int i = 1; i < n; i++) {
+        c->top_power *= HASH_BASE;
+    }
+    return c;
+}
+
+// Double a table that has become half full, re-placing every slot
+static Slot *rehash(Slot *old, int *bits) {
+    size_t old_size = (size_t)1 << *bits;
+    (*bits)++;
+    size_t mask = ((size_t)1 << *bits) - 1;
+    Slot *table = (Slot *)zeroed(mask + 1, sizeof(Slot));
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].index != 0) {
+            size_t j = slot_of(old[i].hash, *bits);
+            while (table[j].index != 0) {
+                j = (j + 1) & mask;
+            }
+            table[j] = old[i];
+        }
+    }
+    free(old);
+    return table;
+}
+
+// Id of a word, adding it to the vocabulary the first time it is seen
+static unsigned intern(NgramCounter *c, const char *word) {
+    unsigned long long h = 0xCBF29CE484222325ULL;  // FNV-1a
+    size_t len = 0;
+    for (; word[len]; len++) {
+        h = (h ^ (unsigned char)word[len]) * 0x100000001B3ULL;
+    }
+
+    size_t mask = ((size_t)1 << c->word_bits) - 1;
+    size_t i = slot_of(h, c->word_bits);
+    while (c->word_slots[i].index != 0) {
+        unsigned id = c->word_slots[i].index - 1;
+        if (c->word_slots[i].hash == h && c->word_len[id] == len && memcmp(c->pool + c->word_offset[id], word, len) == 0) {
+            return id;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (c->nwords == c->words_cap) {
+        c->words_cap = c->words_cap ? 2 * c->words_cap : 1024;
+        c->word_offset = (size_t *)grow(c->word_offset, c->words_cap * sizeof(size_t));
+        c->word_len = (unsigned *)grow(c->word_len, c->words_cap * sizeof(unsigned));
+    }
+    while (c->pool_len + len + 1 > c->pool_cap) {
+        c->pool_cap = c->pool_cap ? 2 * c->pool_cap : 1 << 16;
+        c->pool = (char *)grow(c->pool, c->pool_cap);
+    }
+    unsigned id = c->nwords++;
+    memcpy(c->pool + c->pool_len, word, len + 1);
+    c->word_offset[id] = c->pool_len;
+    c->word_len[id] = len;
+    c->pool_len += len + 1;
+    c->word_slots[i].hash = h;
+    c->word_slots[i].index = id + 1;
+
+    if (2 * (size_t)c->nwords > mask) {
+        c->word_slots = rehash(c->word_slots, &c->word_bits);
+    }
+    return id;
+}
+
+// Does entry e hold the n-gram in the window?
+static int same_ngram(NgramCounter *c, unsigned long long e) {
+    const unsigned *ids = c->ids + e * c->n;
+    for (int k = 0; k < c->n; k++) {
+        if (ids[k] != c->window[(c->start + k) % c->n]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void count_window(NgramCounter *c) {
+    size_t mask = ((size_t)1 << c->slot_bits) - 1;
+    size_t i = slot_of(c->hash, c->slot_bits);
+    while (c->slots[i].index != 0) {
+        unsigned long long e = c->slots[i].index - 1;
+        if (c->slots[i].hash == c->hash && same_ngram(c, e)) {
+            c->counts[e]++;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    // New n-gram: copy its ids out of the window
+    if (c->entries == c->entries_cap) {
+        c->entries_cap = c->entries_cap ? 2 * c->entries_cap : 4096;
+        c->ids = (unsigned *)grow(c->ids, c->entries_cap * c->n * sizeof(unsigned));
+        c->counts = (unsigned long long *)grow(c->counts, c->entries_cap * sizeof(unsigned long long));
+    }
+    unsigned long long e = c->entries++;
+    for (int k = 0; k < c->n; k++) {
+        c->ids[e * c->n + k] = c->window[(c->start + k) % c->n];
+    }
+    c->counts[e] = 1;
+    c->slots[i].hash = c->hash;
+    c->slots[i].index = e + 1;
+
+    // Keep the table at most half full
+    if (2 * c->entries > mask) {
+        c->slots = rehash(c->slots, &c->slot_bits);
+    }
+}
+
+// Push the next word of the token stream; n-grams run across line breaks
+void ngram_add(NgramCounter *c, const char *word) {
+    unsigned long long id = intern(c, word) + 1;  // +1 so id 0 still moves the hash
+
+    if (c->filled == c->n) {
+        // Slide: take the oldest id out of the hash and overwrite its place in the ring
+        unsigned long long oldest = c->window[c->start] + 1;
+        c->hash = (c->hash - oldest * c->top_power) * HASH_BASE + id;
+        c->window[c->start] = id - 1;
+        c->start = (c->start + 1) % c->n;
+    } else {
+        c->hash = c->hash * HASH_BASE + id;
+        c->window[c->filled++] = id - 1;
+        if (c->filled < c->n) {
+            return;
+        }
+    }
+    count_window(c);
+}
+
+unsigned long long ngram_distinct(NgramCounter *c) {
+    return c->entries;
+}
+
+// qsort has no context argument; the counter being written is held here
+static NgramCounter *sorting;
+static unsigned *word_rank;
+static char **ngram_text;
+
+// Rank-order sort key: the first two word ranks packed together, the rest looked up on a tie
+typedef struct {
+    unsigned long long prefix;
+    unsigned long long entry;
+} RankKey;
+
+static int compare_words(const void *a, const void *b) {
+    return strcmp(sorting->pool + sorting->word_offset[*(const unsigned *)a],
+                  sorting->pool + sorting->word_offset[*(const unsigned *)b]);
+}
+
+// Byte order of the joined text is the order of the word ranks, since ' ' sorts before any word byte
+static int compare_ranks(const void *a, const void *b) {
+    const RankKey *x = (const RankKey *)a, *y = (const RankKey *)b;
+    if (x->prefix != y->prefix) {
+        return x->prefix < y->prefix ? -1 : 1;
+    }
+    const unsigned *xi = sorting->ids + x->entry * sorting->n;
+    const unsigned *yi = sorting->ids + y->entry * sorting->n;
+    for (int k = 2; k < sorting->n; k++) {
+        if (word_rank[xi[k]] != word_rank[yi[k]]) {
+            return word_rank[xi[k]] < word_rank[yi[k]] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static int compare_collated(const void *a, const void *b) {
+    return strcoll(ngram_text[((const RankKey *)a)->entry], ngram_text[((const RankKey *)b)->entry]);
+}
+
+static size_t join_ngram(NgramCounter *c, unsigned long long e, char *out) {
+    size_t len = 0;
+    for (int k = 0; k < c->n; k++) {
+        unsigned id = c->ids[e * c->n + k];
+        if (k > 0) {
+            out[len++] = ' ';
+        }
+        memcpy(out + len, c->pool + c->word_offset[id], c->word_len[id]);
+        len += c->word_len[id];
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// Write the counts sorted like sort(1) would sort "w1 w2 ..." lines: in the LC_COLLATE
+// order for the table, or in byte order for a partial file
+void ngram_write(NgramCounter *c, PartialWriter *partial) {
+    RankKey *order = (RankKey *)grow(NULL, (c->entries + 1) * sizeof(RankKey));
+    sorting = c;
+
+    const char *collate = setlocale(LC_COLLATE, NULL);
+    int byte_order = partial != NULL || collate == NULL || strcmp(collate, "C") == 0 || strcmp(collate, "POSIX") == 0;
+
+    unsigned longest = 0;
+    for (unsigned w = 0; w < c->nwords; w++) {
+        if (c->word_len[w] > longest) {
+            longest = c->word_len[w];
+        }
+    }
+    char *text = (char *)grow(NULL, c->n * (longest + 1) + 1);
+
+    if (byte_order) {
+        // Sort the vocabulary once, then n-grams as tuples of ranks
+        unsigned *by_word = (unsigned *)grow(NULL, (c->nwords + 1) * sizeof(unsigned));
+        word_rank = (unsigned *)grow(NULL, (c->nwords + 1) * sizeof(unsigned));
+        for (unsigned w = 0; w < c->nwords; w++) {
+            by_word[w] = w;
+        }
+        qsort(by_word, c->nwords, sizeof(unsigned), compare_words);
+        for (unsigned r = 0; r < c->nwords; r++) {
+            word_rank[by_word[r]] = r;
+        }
+        free(by_word);
+
+        for (unsigned long long e = 0; e < c->entries; e++) {
+            const unsigned *ids = c->ids + e * c->n;
+            order[e].prefix = (unsigned long long)word_rank[ids[0]] << 32 | (c->n > 1 ? word_rank[ids[1]] : 0);
+            order[e].entry = e;
+        }
+        qsort(order, c->entries, sizeof(RankKey), compare_ranks);
+        free(word_rank);
+    } else {
+        ngram_text = (char **)grow(NULL, (c->entries + 1) * sizeof(char *));
+        for (unsigned long long e = 0; e < c->entries; e++) {
+            size_t len = join_ngram(c, e, text);
+            ngram_text[e] = (char *)grow(NULL, len + 1);
+            memcpy(ngram_text[e], text, len + 1);
+            order[e].entry = e;
+        }
+        qsort(order, c->entries, sizeof(RankKey), compare_collated);
+    }
+
+    for (unsigned long long i = 0; i < c->entries; i++) {
+        unsigned long long e = order[i].entry;
+        const char *key = text;
+        if (byte_order) {
+            join_ngram(c, e, text);
+        } else {
+            key = ngram_text[e];
+        }
+        if (partial != NULL) {
+            partial_add(partial, key, c->counts[e]);
+        } else {
+            printf("%-10llu%s\n", c->counts[e], key);
+        }
+    }
+
+    if (!byte_order) {
+        for (unsigned long long e = 0; e < c->entries; e++) {
+            free(ngram_text[e]);
+        }
+        free(ngram_text);
+    }
+    free(text);
+    free(order);
+}
+
+void ngram_free(NgramCounter *c) {
+    free(c->pool);
+    free(c->word_offset);
+    free(c->word_len);
+    free(c->word_slots);
+    free(c->ids);
+    free(c->counts);
+    free(c->slots);
+    free(c);
+}
@@ -0,0 +1,21 @@
+/*
+In-process n-gram counting for pipesort -g N: words are interned to small
+ids, and a rolling hash over the last N ids finds the n-gram's entry, so
+the text of an n-gram is only put together when the table is written out
+*/
+#ifndef NGRAM_H
+#define NGRAM_H
+
+#include "partial.h"
+
+#define MAX_NGRAM 8
+
+typedef struct NgramCounter NgramCounter;
+
+NgramCounter *ngram_create(int n);
+void ngram_add(NgramCounter *c, const char *word);
+unsigned long long ngram_distinct(NgramCounter *c);
+void ngram_write(NgramCounter *c, PartialWriter *partial);
+void ngram_free(NgramCounter *c);
+
+#endif
@@ -0,0 +1,295 @@
+#include "partial.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define IO_BUFFER_SIZE (1 << 16)
+
+struct PartialWriter {
+    FILE *fp;
+    const char *path;
+    char prev[PARTIAL_MAX_KEY + 1];
+    size_t prev_len;
+    unsigned long long words;
+};
+
+struct PartialReader {
+    FILE *fp;
+    const char *path;
+    char key[PARTIAL_MAX_KEY + 1];
+    size_t key_len;
+    unsigned long long count;   // count of the current key
+    unsigned long long words;
+    int ended;
+};
+
+static void put_varint(FILE *fp, unsigned long long v) {
+    while (v >= 0x80) {
+        putc((int)(v & 0x7F) | 0x80, fp);
+        v >>= 7;
+    }
+    putc((int)v, fp);
+}
+
+// LEB128 varint; 0 on success, -1 on end of file or an overlong encoding
+static int get_varint(FILE *fp, unsigned long long *v) {
+    unsigned long long result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(fp);
+        if (c == EOF) {
+            return -1;
+        }
+        result |= (unsigned long long)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *v = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+PartialWriter *partial_create(const char *path) {
+    PartialWriter *w = (PartialWriter *)calloc(1, sizeof(PartialWriter));
+    if (w == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    w->path = path;
+    w->fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (w->fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    setvbuf(w->fp, NULL, _IOFBF, IO_BUFFER_SIZE);
+    fwrite(PARTIAL_MAGIC, 1, strlen(PARTIAL_MAGIC), w->fp);
+    return w;
+}
+
+// Keys must arrive in strictly increasing strcmp order
+void partial_add(PartialWriter *w, const char *key, unsigned long long count) {
+    size_t len = strlen(key);
+    if (len == 0 || len > PARTIAL_MAX_KEY || count == 0) {
+        fprintf(stderr, "pipesort: invalid partial count entry\n");
+        exit(1);
+    }
+    if (w->words > 0 && strcmp(key, w->prev) <= 0) {
+        fprintf(stderr, "pipesort: partial count keys out of order (%s after %s); is sort using LC_ALL=C?\n", key, w->prev);
+        exit(1);
+    }
+
+    size_t shared = 0;
+    while (shared < len && shared < w->prev_len && key[shared] == w->prev[shared]) {
+        shared++;
+    }
+    put_varint(w->fp, shared);
+    put_varint(w->fp, len - shared);
+    fwrite(key + shared, 1, len - shared, w->fp);
+    put_varint(w->fp, count);
+
+    memcpy(w->prev, key, len + 1);
+    w->prev_len = len;
+    w->words++;
+}
+
+// Writes the end marker and closes the file; 0 on success
+int partial_close(PartialWriter *w) {
+    put_varint(w->fp, 0);
+    put_varint(w->fp, 0);
+    put_varint(w->fp, w->words);
+
+    int failed = fflush(w->fp) != 0 || ferror(w->fp);
+    if (w->fp != stdout && fclose(w->fp) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        perror(w->path);
+    }
+    free(w);
+    return failed ? -1 : 0;
+}
+
+// Gives up on the file without an end marker, so it can never pass for a complete one;
+// a named file is removed
+void partial_abort(PartialWriter *w) {
+    if (w->fp != stdout) {
+        fclose(w->fp);
+        unlink(w->path);
+    } else {
+        fflush(w->fp);
+    }
+    free(w);
+}
+
+PartialReader *partial_open(const char *path) {
+    PartialReader *r = (PartialReader *)calloc(1, sizeof(PartialReader));
+    if (r == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    r->path = path;
+    r->fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (r->fp == NULL) {
+        perror(path);
+        free(r);
+        return NULL;
+    }
+    setvbuf(r->fp, NULL, _IOFBF, IO_BUFFER_SIZE);
+
+    char magic[sizeof(PARTIAL_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), r->fp) != sizeof(magic) || memcmp(magic, PARTIAL_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "pipesort: %s is not a partial count file\n", path);
+        partial_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// Next word and count in strcmp order; 1 for a word, 0 at the end marker, -1 if the file is damaged.
+// The key stays valid until the next call.
+int partial_next(PartialReader *r, const char **key, unsigned long long *count) {
+    if (r->ended) {
+        return 0;
+    }
+
+    unsigned long long shared, suffix, total;
+    if (get_varint(r->fp, &shared) < 0 || get_varint(r->fp, &suffix) < 0) {
+        fprintf(stderr, "pipesort: %s: truncated partial count file\n", r->path);
+        return -1;
+    }
+    if (shared == 0 && suffix == 0) {
+        if (get_varint(r->fp, &total) < 0 || total != r->words || getc(r->fp) != EOF) {
+            fprintf(stderr, "pipesort: %s: bad end marker\n", r->path);
+            return -1;
+        }
+        r->ended = 1;
+        return 0;
+    }
+
+    // Front coding only allows a key longer than, or sorting after, the previous one
+    if (shared > r->key_len || shared + suffix > PARTIAL_MAX_KEY || suffix == 0) {
+        fprintf(stderr, "pipesort: %s: corrupt partial count file\n", r->path);
+        return -1;
+    }
+    unsigned char old = shared < r->key_len ? r->key[shared] : 0;
+    if (fread(r->key + shared, 1, suffix, r->fp) != suffix || get_varint(r->fp, count) < 0) {
+        fprintf(stderr, "pipesort: %s: truncated partial count file\n", r->path);
+        return -1;
+    }
+    if ((unsigned char)r->key[shared] <= old || *count == 0) {
+        fprintf(stderr, "pipesort: %s: corrupt partial count file\n", r->path);
+        return -1;
+    }
+    r->key_len = shared + suffix;
+    r->key[r->key_len] = '\0';
+    if (memchr(r->key, '\0', r->key_len) != NULL) {
+        fprintf(stderr, "pipesort: %s: corrupt partial count file\n", r->path);
+        return -1;
+    }
+    r->words++;
+    r->count = *count;
+    *key = r->key;
+    return 1;
+}
+
+void partial_free(PartialReader *r) {
+    if (r->fp != stdin) {
+        fclose(r->fp);
+    }
+    free(r);
+}
+
+// Min-heap of readers ordered by their current key
+static void sift_down(PartialReader **heap, int n, int i) {
+    while (1) {
+        int smallest = i;
+        int l = 2 * i + 1, r = l + 1;
+        if (l < n && strcmp(heap[l]->key, heap[smallest]->key) < 0) smallest = l;
+        if (r < n && strcmp(heap[r]->key, heap[smallest]->key) < 0) smallest = r;
+        if (smallest == i) {
+            return;
+        }
+        PartialReader *tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// k-way merge of partial count files, summing the counts of words found in several.
+// Writes the usual count table to stdout, or another partial file when partial_out is set.
+// Returns 0 on success, 1 if an input is missing or damaged.
+int partial_merge(char **paths, int n, const char *partial_out) {
+    PartialReader **readers = (PartialReader **)calloc(n, sizeof(PartialReader *));
+    PartialReader **heap = (PartialReader **)malloc(n * sizeof(PartialReader *));
+    if (readers == NULL || heap == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    int failed = 0;
+    int live = 0;
+    const char *key;
+    unsigned long long count;
+    for (int i = 0; i < n && !failed; i++) {
+        readers[i] = partial_open(paths[i]);
+        if (readers[i] == NULL) {
+            failed = 1;
+            break;
+        }
+        int ret = partial_next(readers[i], &key, &count);
+        if (ret < 0) {
+            failed = 1;
+        } else if (ret > 0) {
+            heap[live++] = readers[i];
+        }
+    }
+
+    PartialWriter *out = NULL;
+    if (!failed && partial_out != NULL) {
+        out = partial_create(partial_out);
+    }
+    for (int i = live / 2 - 1; i >= 0; i--) {
+        sift_down(heap, live, i);
+    }
+
+    // Pop the smallest key, fold in every reader positioned on the same key, emit once
+    char word[PARTIAL_MAX_KEY + 1];
+    while (!failed && live > 0) {
+        strcpy(word, heap[0]->key);
+        unsigned long long total = 0;
+        while (live > 0 && strcmp(heap[0]->key, word) == 0) {
+            total += heap[0]->count;
+            int ret = partial_next(heap[0], &key, &count);
+            if (ret < 0) {
+                failed = 1;
+                break;
+            }
+            if (ret == 0) {
+                heap[0] = heap[--live];
+            }
+            sift_down(heap, live, 0);
+        }
+        if (out != NULL) {
+            partial_add(out, word, total);
+        } else {
+            printf("%-10llu%s\n", total, word);
+        }
+    }
+
+    if (out != NULL) {
+        if (failed) {
+            partial_abort(out);
+        } else if (partial_close(out) != 0) {
+            failed = 1;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (readers[i] != NULL) {
+            partial_free(readers[i]);
+        }
+    }
+    free(readers);
+    free(heap);
+    return failed;
+}
@@ -0,0 +1,31 @@
+/*
+Partial count files: a shard's word counts in strcmp order, written with
+front-coded keys and varint counts, so shards counted separately can be
+combined by pipesort --merge without re-parsing or re-sorting text.
+
+  magic "PSCOUNT1"
+  per word:   varint shared prefix, varint suffix length, suffix, varint count
+  end marker: varint 0, varint 0 (an empty key), varint number of words
+*/
+#ifndef PARTIAL_H
+#define PARTIAL_H
+
+#define PARTIAL_MAGIC "PSCOUNT1"
+#define PARTIAL_MAX_KEY 4096   // longest key a reader accepts
+
+typedef struct PartialWriter PartialWriter;
+typedef struct PartialReader PartialReader;
+
+// "-" is stdout for the writer and stdin for the reader
+PartialWriter *partial_create(const char *path);
+void partial_add(PartialWriter *w, const char *key, unsigned long long count);
+int partial_close(PartialWriter *w);
+void partial_abort(PartialWriter *w);
+
+PartialReader *partial_open(const char *path);
+int partial_next(PartialReader *r, const char **key, unsigned long long *count);
+void partial_free(PartialReader *r);
+
+int partial_merge(char **paths, int n, const char *partial_out);
+
+#endif
@@ -7,11 +7,51 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h> 
+#include <getopt.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <locale.h>
+#include "utf8.h"
+#include "readahead.h"
+#include "partial.h"
+#include "ngram.h"
 
 #define MAX_WORD_LENGTH 256  // Maximum length for a word
 #define BUFFER_SIZE 1024     // Buffer size for reading input -- read line by line
 
+// Per-stage counters and timings reported by -v/--stats
+typedef struct {
+    int enabled;
+    int json;
+    const char *input_format;            // raw, gzip or zstd
+    unsigned long long bytes_read;
+    unsigned long long lines;
+    unsigned long long words_emitted;
+    unsigned long long words_short;      // dropped by -s
+    unsigned long long words_truncated;  // cut down by -l
+    unsigned long long unique_words;
+    double read_time;       // waiting for input lines
+    double tokenize_time;   // preprocess_input, strtok, to_lowercase
+    double write_time;      // blocked writing words into the sorter pipe
+    double sort_time;       // waiting for sort's first line of output
+    double sort_cpu;        // user + system time of the sort process
+    double count_time;      // reading sort's output and counting
+    double total_time;
+} Stats;
+
+static Stats stats;
+
+// Wall clock for the stats; 0 when stats are off so timing costs one branch
+static double stat_clock(void) {
+    if (!stats.enabled) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 // Helper func to convert words to lowercase
 void to_lowercase(char *word) {
     for (int i = 0; word[i]; i++) {
@@ -28,12 +68,14 @@ void preprocess_input(char *buffer) {
 }
 
 // helper function to check validity of word token
+// En and em dashes are multibyte in UTF-8, so they are matched as byte sequences;
+// any other non-ASCII byte left after preprocessing belongs to a -u word character
 int check_for_word(const char *token) {
     while (*token) {
-        if (isalnum((unsigned char)*token)) {
-            return 1;
-        } else if (*token == '-' || *token == '–' || *token == '—') {
+        if (*token == '-' || strncmp(token, EN_DASH, 3) == 0 || strncmp(token, EM_DASH, 3) == 0) {
             return 0; 
+        } else if (isalnum((unsigned char)*token) || (unsigned char)*token >= 0x80) {
+            return 1;
         }
         token++;
     }
@@ -41,10 +83,18 @@ int check_for_word(const char *token) {
 }
 
 
-void parse_input(int pipe_fd, int short_len, int long_len) {
+// Next line of input, from the read-ahead thread or straight from stdin
+static char *read_line(ReadAhead *input, char *buf, int size) {
+    return input != NULL ? readahead_gets(input, buf, size) : fgets(buf, size, stdin);
+}
+
+// Words go down the pipe to the sorter, or to the n-gram counter for -g
+void parse_input(int pipe_fd, NgramCounter *ngrams, int short_len, int long_len, int utf8_mode, int readahead) {
     char buffer[BUFFER_SIZE];  // Buffer for reading input from stdin
-    FILE *sorter_stream = fdopen(pipe_fd, "w");
-    if (sorter_stream == NULL) {
+    char folded[UTF8_MAX_GROWTH * BUFFER_SIZE];  // -u: case-folded copy of the buffer
+    size_t carry = 0;  // -u: bytes of a character split across two reads
+    FILE *sorter_stream = ngrams != NULL ? NULL : fdopen(pipe_fd, "w");
+    if (ngrams == NULL && sorter_stream == NULL) {
         perror("fdopen");
         exit(1);
     }
@@ -54,12 +104,36 @@ void parse_input(int pipe_fd, int short_len, int long_len) {
         fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
     }
 
+    // The read-ahead thread reads and decompresses while this loop tokenizes
+    ReadAhead *input = readahead ? readahead_start(STDIN_FILENO) : NULL;
+
     int read_count = 0;  // Counter for number of reads
     const int MAX_READS = 1000000;  // Limit for reads to avoid indefinite looping for very large files
 
     // Read input line by line
-    while (fgets(buffer, BUFFER_SIZE, stdin)) {
-        preprocess_input(buffer);  // Preprocess the buffer to remove punctuation and other elements    
+    double t = stat_clock();
+    while (read_line(input, buffer + carry, BUFFER_SIZE - carry)) {
+        double now = stat_clock();
+        stats.read_time += now - t;
+        t = now;
+        size_t len = carry + strlen(buffer + carry);
+        if (stats.enabled) {
+            stats.bytes_read += len - carry;
+            stats.lines++;
+        }
+
+        char *line = buffer;
+        if (utf8_mode) {
+            // Hold back a character cut off by the buffer end until the next read
+            size_t tail = utf8_incomplete_tail(buffer, len);
+            size_t n = utf8_preprocess(buffer, len - tail, folded);
+            folded[n] = '\0';
+            memmove(buffer, buffer + len - tail, tail);
+            carry = tail;
+            line = folded;
+        } else {
+            preprocess_input(buffer);  // Preprocess the buffer to remove punctuation and other elements    
+        }
         read_count++;
         // printf("Reading line %d: %s", read_count, buffer);  // Debug print
 
@@ -68,39 +142,76 @@ void parse_input(int pipe_fd, int short_len, int long_len) {
             break;
         }
        
-        char *word = strtok(buffer, " \t\n"); 
+        char *word = strtok(line, " \t\n"); 
         while (word != NULL && check_for_word(word)) {
-            int len = strlen(word);
+            // -u measures words in characters, not bytes
+            int len = utf8_mode ? (int)utf8_length(word) : (int)strlen(word);
             
             //printf("word in parse_input: %s \n", word); //DEBUGGING PRINTS
 
-            // Convert the word to lowercase for case-insensitive comparison
-            to_lowercase(word);
+            // Convert the word to lowercase for case-insensitive comparison (-u has already folded it)
+            if (!utf8_mode) {
+                to_lowercase(word);
+            }
 
             // Filter words based on `short_len` and `long_len`
             if (len > short_len) {
                 if (len > long_len) {
-                    word[long_len] = '\0';  // Truncate the word if it exceeds `long_len`
+                    // Truncate the word if it exceeds `long_len`
+                    word[utf8_mode ? utf8_offset(word, long_len) : (size_t)long_len] = '\0';
+                    stats.words_truncated++;
                 }
                 // Write the word to the sorter pipe
-                fprintf(sorter_stream, "%s\n", word);
-                if (ferror(sorter_stream)) {
+                now = stat_clock();
+                stats.tokenize_time += now - t;
+                t = now;
+                if (ngrams != NULL) {
+                    ngram_add(ngrams, word);
+                } else {
+                    fprintf(sorter_stream, "%s\n", word);
+                }
+                now = stat_clock();
+                stats.write_time += now - t;
+                t = now;
+                stats.words_emitted++;
+                if (sorter_stream != NULL && ferror(sorter_stream)) {
                     perror("Error writing to sorter stream");
                     break;
                 }
+            } else {
+                stats.words_short++;
             }
 
             // Get the next word from the input line
             word = strtok(NULL, " \t\n"); 
         }
+        now = stat_clock();
+        stats.tokenize_time += now - t;
+        t = now;
+    }
+
+    if (input != NULL) {
+        stats.input_format = readahead_format(input);
+        readahead_stop(input);
     }
 
     // Close the write end of the pipe after writing all input words
-    fclose(sorter_stream);
+    if (sorter_stream != NULL) {
+        fclose(sorter_stream);
+    }
+    stats.write_time += stat_clock() - t;
 }
 
-// Count words and print at terminal
-void count_words(int pipe_fd) {
+static void emit_count(PartialWriter *partial, int count, const char *word) {
+    if (partial != NULL) {
+        partial_add(partial, word, count);
+    } else {
+        printf("%-10d%s\n", count, word);
+    }
+}
+
+// Count words and print at terminal, or add them to a partial count file (-p)
+void count_words(int pipe_fd, PartialWriter *partial) {
 
     FILE *sorter_output = fdopen(pipe_fd, "r");
     if (sorter_output == NULL) {
@@ -112,8 +223,18 @@ void count_words(int pipe_fd) {
     char prev_word[MAX_WORD_LENGTH] = "";
     int word_count = 0;
     
+    // sort emits nothing until it has read and sorted all of its input
+    double t = stat_clock();
+    int first = 1;
+    
     // Read from sorter output and count unique words
     while (fgets(word, MAX_WORD_LENGTH, sorter_output)) {
+        if (first) {
+            double now = stat_clock();
+            stats.sort_time = now - t;
+            t = now;
+            first = 0;
+        }
         
         word[strcspn(word, "\n")] = '\0';  // Remove newline
         // Compare with the previous word for counting because sorting has already been done
@@ -122,7 +243,8 @@ void count_words(int pipe_fd) {
         } else {
             // Print the previous word and its count if it exists
             if (prev_word[0] != '\0') {
-                printf("%-10d%s\n", word_count, prev_word);  // Print count and word
+                emit_count(partial, word_count, prev_word);  // Print count and word
+                stats.unique_words++;
             }
             //printf("word in counting: %s \n", prev_word);
             // Update the previous word to the current word
@@ -133,19 +255,76 @@ void count_words(int pipe_fd) {
     
     // Print the last word and its count
     if (prev_word[0] != '\0') {
-        printf("%-10d%s\n", word_count, prev_word);
+        emit_count(partial, word_count, prev_word);
+        stats.unique_words++;
     }
 
     fclose(sorter_output);
+    if (first) {
+        stats.sort_time = stat_clock() - t;
+    } else {
+        stats.count_time = stat_clock() - t;
+    }
+}
+
+// Print the -v/--stats report to stderr
+void print_stats(void) {
+    double words_per_sec = stats.total_time > 0 ? stats.words_emitted / stats.total_time : 0;
+
+    if (stats.json) {
+        fprintf(stderr, "{\"input_format\": \"%s\", \"bytes_read\": %llu, \"lines\": %llu, \"words_emitted\": %llu, "
+                "\"words_short\": %llu, \"words_truncated\": %llu, \"unique_words\": %llu, "
+                "\"read_s\": %.6f, \"tokenize_s\": %.6f, \"pipe_write_s\": %.6f, "
+                "\"sort_wait_s\": %.6f, \"sort_cpu_s\": %.6f, \"count_s\": %.6f, "
+                "\"total_s\": %.6f, \"words_per_sec\": %.0f}\n",
+                stats.input_format, stats.bytes_read, stats.lines, stats.words_emitted,
+                stats.words_short, stats.words_truncated, stats.unique_words,
+                stats.read_time, stats.tokenize_time, stats.write_time,
+                stats.sort_time, stats.sort_cpu, stats.count_time,
+                stats.total_time, words_per_sec);
+        return;
+    }
+
+    fprintf(stderr, "pipesort stats:\n");
+    fprintf(stderr, "  input format     %s\n", stats.input_format);
+    fprintf(stderr, "  bytes read       %llu\n", stats.bytes_read);
+    fprintf(stderr, "  lines            %llu\n", stats.lines);
+    fprintf(stderr, "  words emitted    %llu\n", stats.words_emitted);
+    fprintf(stderr, "  filtered (-s)    %llu\n", stats.words_short);
+    fprintf(stderr, "  truncated (-l)   %llu\n", stats.words_truncated);
+    fprintf(stderr, "  unique words     %llu\n", stats.unique_words);
+    fprintf(stderr, "  read (wait)      %.6f s\n", stats.read_time);
+    fprintf(stderr, "  tokenize         %.6f s\n", stats.tokenize_time);
+    fprintf(stderr, "  pipe write       %.6f s\n", stats.write_time);
+    fprintf(stderr, "  sort (wait)      %.6f s\n", stats.sort_time);
+    fprintf(stderr, "  sort (cpu)       %.6f s\n", stats.sort_cpu);
+    fprintf(stderr, "  count            %.6f s\n", stats.count_time);
+    fprintf(stderr, "  total            %.6f s\n", stats.total_time);
+    fprintf(stderr, "  words/sec        %.0f\n", words_per_sec);
 }
 
 int main(int argc, char *argv[]) {
     int opt;
     int short_len = 0; 
     int long_len = MAX_WORD_LENGTH;
+    int utf8_mode = 0;
+    int readahead = 1;
+    const char *partial_path = NULL;
+    int merge = 0;
+    int ngram_n = 0;
+
+    static struct option long_options[] = {
+        {"stats", optional_argument, NULL, 'v'},
+        {"utf8",  no_argument,       NULL, 'u'},
+        {"no-readahead", no_argument, NULL, 'R'},
+        {"partial", required_argument, NULL, 'p'},
+        {"merge", no_argument, NULL, 'm'},
+        {"ngrams", required_argument, NULL, 'g'},
+        {NULL, 0, NULL, 0}
+    };
 
     // Parse command-line options with getopt
-    while ((opt = getopt(argc, argv, "n:s:l:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "n:s:l:vuRp:mg:", long_options, NULL)) != -1) {
         switch (opt) {
             case 'n': // sorter == 1 by default
                 break;
@@ -163,13 +342,80 @@ int main(int argc, char *argv[]) {
                     exit(1);
                 }
                 break;
+            case 'R': // read stdin directly with fgets, no thread and no decompression
+                readahead = 0;
+                stats.input_format = "raw";
+                break;
+            case 'p': // write a binary partial count file instead of the table
+                partial_path = optarg;
+                break;
+            case 'm': // merge the partial count files named after the options
+                merge = 1;
+                break;
+            case 'g': // count n-grams of N words in process instead of sorting words
+                ngram_n = atoi(optarg);
+                if (ngram_n < 1 || ngram_n > MAX_NGRAM) {
+                    fprintf(stderr, "Invalid n-gram length (1-%d)\n", MAX_NGRAM);
+                    exit(1);
+                }
+                break;
+            case 'u': // UTF-8 aware tokenizing and case folding
+                utf8_mode = 1;
+                utf8_init();
+                break;
+            case 'v': // -v or --stats for text, --stats=json for JSON
+                stats.enabled = 1;
+                if (optarg != NULL) {
+                    if (strcmp(optarg, "json") == 0) {
+                        stats.json = 1;
+                    } else if (strcmp(optarg, "text") != 0) {
+                        fprintf(stderr, "Invalid stats format: %s\n", optarg);
+                        exit(1);
+                    }
+                }
+                break;
             default:
                 // Print usage information 
-                fprintf(stderr, "Usage: pipesort [-n count] [-s short] [-l long]\n");
+                fprintf(stderr, "Usage: pipesort [-n count] [-s short] [-l long] [-u|--utf8] [-R|--no-readahead] [-g|--ngrams N] [-p|--partial FILE] [-v|--stats[=text|json]]\n"
+                                "       pipesort -m|--merge [-p|--partial FILE] PARTIAL...\n");
                 exit(1);
         }
     }
 
+    if (merge) {
+        if (optind == argc) {
+            fprintf(stderr, "pipesort: --merge needs at least one partial count file\n");
+            exit(1);
+        }
+        return partial_merge(argv + optind, argc - optind, partial_path);
+    }
+
+    double start = stat_clock();
+
+    if (ngram_n > 0) {
+        // No sorter: count in a hash table and sort the distinct n-grams, the way sort(1) would order them
+        setlocale(LC_COLLATE, "");
+        NgramCounter *ngrams = ngram_create(ngram_n);
+        parse_input(-1, ngrams, short_len, long_len, utf8_mode, readahead);
+
+        double t = stat_clock();
+        PartialWriter *partial = partial_path != NULL ? partial_create(partial_path) : NULL;
+        ngram_write(ngrams, partial);
+        if (partial != NULL && partial_close(partial) != 0) {
+            exit(1);
+        }
+        stats.unique_words = ngram_distinct(ngrams);
+        stats.count_time = stat_clock() - t;
+        ngram_free(ngrams);
+
+        if (stats.enabled) {
+            stats.total_time = stat_clock() - start;
+            fflush(stdout);
+            print_stats();
+        }
+        return 0;
+    }
+
     // pipes fo
     int parse_to_sort_pipe[2];
     int sort_to_count_pipe[2];
@@ -194,6 +440,10 @@ int main(int argc, char *argv[]) {
         close(parse_to_sort_pipe[0]);
         close(sort_to_count_pipe[1]);
 
+        // Partial files are merged by strcmp, so sort has to use byte order too
+        if (partial_path != NULL) {
+            setenv("LC_ALL", "C", 1);
+        }
         execl("/usr/bin/sort", "sort", NULL);
         perror("execl");
         exit(1);
@@ -203,12 +453,30 @@ int main(int argc, char *argv[]) {
     close(parse_to_sort_pipe[0]); // Close read end of the first pipe
     close(sort_to_count_pipe[1]); // Close write end of the second pipe
 
-    parse_input(parse_to_sort_pipe[1], short_len, long_len);
+    parse_input(parse_to_sort_pipe[1], NULL, short_len, long_len, utf8_mode, readahead);
     close(parse_to_sort_pipe[1]); // Close write end after parsing input
 
     // Continue to counting words after sorter completes
-    count_words(sort_to_count_pipe[0]);
+    PartialWriter *partial = partial_path != NULL ? partial_create(partial_path) : NULL;
+    count_words(sort_to_count_pipe[0], partial);
     close(sort_to_count_pipe[0]);
+    if (partial != NULL && partial_close(partial) != 0) {
+        exit(1);
+    }
+
+    // Reap the sorter, collecting its CPU time for the stats
+    struct rusage usage;
+    int status;
+    if (wait4(sorter_pid, &status, 0, &usage) > 0) {
+        stats.sort_cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+                       + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    }
+
+    if (stats.enabled) {
+        stats.total_time = stat_clock() - start;
+        fflush(stdout);
+        print_stats();
+    }
 
     return 0;
 }
@@ -0,0 +1,330 @@
+#include "readahead.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define INPUT_SIZE (1 << 18)  // compressed bytes read per call
+
+typedef enum { FORMAT_RAW, FORMAT_GZIP, FORMAT_ZSTD } Format;
+
+// One buffer of the ring
+typedef struct {
+    char *data;
+    size_t len;
+    int full;   // filled by the thread and not yet consumed
+    int eof;    // last chunk of the input
+} Chunk;
+
+struct ReadAhead {
+    int fd;
+    Format format;
+    Chunk chunks[READAHEAD_CHUNKS];
+    int fill;                // next chunk the thread fills
+    int take;                // chunk the consumer reads from
+    size_t pos;              // consumer position in chunks[take]
+    int done;                // consumer has reached the end of the input
+    int stop;                // consumer quit early
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    // Thread side: raw input and decompressor state
+    unsigned char *in;
+    size_t in_len, in_pos;
+    int in_eof;
+    int stream_open;         // inside a gzip member or zstd frame
+    z_stream zs;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zds;
+#endif
+};
+
+// read() and poll() are the only places the thread can be cancelled: it never
+// holds r->lock there, and everywhere else stop is enough to end it
+static ssize_t cancellable_read(int fd, void *dst, size_t size) {
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    ssize_t n = read(fd, dst, size);
+    int saved = errno;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    errno = saved;
+    return n;
+}
+
+static void cancellable_poll(struct pollfd *p) {
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    poll(p, 1, -1);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+}
+
+// read() that waits on O_NONBLOCK descriptors and retries interrupted calls; 0 at end of input
+static size_t read_input(ReadAhead *r, void *dst, size_t size) {
+    while (1) {
+        ssize_t n = cancellable_read(r->fd, dst, size);
+        if (n >= 0) {
+            return n;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd p = {r->fd, POLLIN, 0};
+            cancellable_poll(&p);
+            continue;
+        }
+        perror("read");
+        return 0;
+    }
+}
+
+// Make sure there is unread input, reading more if needed; 0 at end of input
+static int refill(ReadAhead *r) {
+    if (r->in_pos < r->in_len) {
+        return 1;
+    }
+    if (r->in_eof) {
+        return 0;
+    }
+    r->in_len = read_input(r, r->in, INPUT_SIZE);
+    r->in_pos = 0;
+    if (r->in_len == 0) {
+        r->in_eof = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// Fill chunk c from the input; returns 1 once the input is exhausted
+static int fill_chunk(ReadAhead *r, Chunk *c) {
+    if (r->format == FORMAT_RAW) {
+        // Bytes read while sniffing the format come first
+        if (r->in_pos < r->in_len) {
+            size_t n = r->in_len - r->in_pos;
+            memcpy(c->data, r->in + r->in_pos, n);
+            r->in_pos = r->in_len;
+            c->len = n;
+            return 0;
+        }
+        size_t n = read_input(r, c->data, READAHEAD_CHUNK_SIZE);
+        c->len = n;
+        return n == 0;
+    }
+
+    while (c->len < READAHEAD_CHUNK_SIZE) {
+        if (!refill(r)) {
+            if (r->stream_open) {
+                fprintf(stderr, "pipesort: truncated %s input\n", readahead_format(r));
+            }
+            return 1;
+        }
+
+        if (r->format == FORMAT_GZIP) {
+            r->zs.next_in = r->in + r->in_pos;
+            r->zs.avail_in = r->in_len - r->in_pos;
+            r->zs.next_out = (unsigned char *)c->data + c->len;
+            r->zs.avail_out = READAHEAD_CHUNK_SIZE - c->len;
+            int ret = inflate(&r->zs, Z_NO_FLUSH);
+            r->in_pos = r->in_len - r->zs.avail_in;
+            c->len = READAHEAD_CHUNK_SIZE - r->zs.avail_out;
+            r->stream_open = 1;
+
+            if (ret == Z_STREAM_END) {
+                // Concatenated members (cat a.gz b.gz) each start a fresh stream
+                r->stream_open = 0;
+                if (!refill(r)) {
+                    return 1;
+                }
+                inflateReset(&r->zs);
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                fprintf(stderr, "pipesort: corrupt gzip input: %s\n", r->zs.msg ? r->zs.msg : "unknown error");
+                return 1;
+            }
+        } else {
+#ifdef HAVE_ZSTD
+            ZSTD_inBuffer in = {r->in, r->in_len, r->in_pos};
+            ZSTD_outBuffer out = {c->data, READAHEAD_CHUNK_SIZE, c->len};
+            size_t ret = ZSTD_decompressStream(r->zds, &out, &in);
+            r->in_pos = in.pos;
+            c->len = out.pos;
+            if (ZSTD_isError(ret)) {
+                fprintf(stderr, "pipesort: corrupt zstd input: %s\n", ZSTD_getErrorName(ret));
+                return 1;
+            }
+            r->stream_open = (ret != 0);  // 0 once a frame is complete
+#else
+            return 1;
+#endif
+        }
+    }
+    return 0;
+}
+
+static void *reader_main(void *arg) {
+    ReadAhead *r = (ReadAhead *)arg;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);  // see cancellable_read
+
+    // Sniff the format from the first bytes
+    while (r->in_len < 4 && !r->in_eof) {
+        size_t n = read_input(r, r->in + r->in_len, INPUT_SIZE - r->in_len);
+        if (n == 0) {
+            r->in_eof = 1;
+        }
+        r->in_len += n;
+    }
+    if (r->in_len >= 2 && r->in[0] == 0x1F && r->in[1] == 0x8B) {
+        r->format = FORMAT_GZIP;
+        inflateInit2(&r->zs, 15 + 16);
+    } else if (r->in_len >= 4 && r->in[0] == 0x28 && r->in[1] == 0xB5 && r->in[2] == 0x2F && r->in[3] == 0xFD) {
+        r->format = FORMAT_ZSTD;
+#ifdef HAVE_ZSTD
+        r->zds = ZSTD_createDStream();
+        ZSTD_initDStream(r->zds);
+#else
+        fprintf(stderr, "pipesort: zstd input needs a build with libzstd\n");
+#endif
+    }
+
+    int finished = 0;
+    while (!finished) {
+        Chunk *c = &r->chunks[r->fill];
+
+        pthread_mutex_lock(&r->lock);
+        while (c->full && !r->stop) {
+            pthread_cond_wait(&r->changed, &r->lock);
+        }
+        int stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+        if (stop) {
+            break;
+        }
+
+        c->len = 0;
+        finished = fill_chunk(r, c);
+
+        pthread_mutex_lock(&r->lock);
+        c->eof = finished;
+        c->full = 1;
+        r->fill = (r->fill + 1) % READAHEAD_CHUNKS;
+        pthread_cond_broadcast(&r->changed);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+ReadAhead *readahead_start(int fd) {
+    ReadAhead *r = (ReadAhead *)calloc(1, sizeof(ReadAhead));
+    if (r == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    r->fd = fd;
+    r->in = (unsigned char *)malloc(INPUT_SIZE);
+    for (int i = 0; i < READAHEAD_CHUNKS; i++) {
+        r->chunks[i].data = (char *)malloc(READAHEAD_CHUNK_SIZE);
+        if (r->chunks[i].data == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    if (r->in == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->changed, NULL);
+    if (pthread_create(&r->thread, NULL, reader_main, r) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    return r;
+}
+
+// Same contract as fgets: up to size-1 bytes, stopping after a newline; NULL at end of input
+char *readahead_gets(ReadAhead *r, char *buf, int size) {
+    int n = 0;
+
+    while (n < size - 1 && !r->done) {
+        Chunk *c = &r->chunks[r->take];
+
+        pthread_mutex_lock(&r->lock);
+        while (!c->full) {
+            pthread_cond_wait(&r->changed, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        if (r->pos == c->len) {
+            // Chunk used up: hand it back to the thread
+            int eof = c->eof;
+            pthread_mutex_lock(&r->lock);
+            c->full = 0;
+            r->take = (r->take + 1) % READAHEAD_CHUNKS;
+            r->pos = 0;
+            pthread_cond_broadcast(&r->changed);
+            pthread_mutex_unlock(&r->lock);
+            if (eof) {
+                r->done = 1;
+            }
+            continue;
+        }
+
+        size_t take = c->len - r->pos;
+        if (take > (size_t)(size - 1 - n)) {
+            take = size - 1 - n;
+        }
+        char *start = c->data + r->pos;
+        char *newline = memchr(start, '\n', take);
+        if (newline != NULL) {
+            take = newline - start + 1;
+        }
+        memcpy(buf + n, start, take);
+        n += take;
+        r->pos += take;
+        if (newline != NULL) {
+            break;
+        }
+    }
+
+    if (n == 0) {
+        return NULL;
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+const char *readahead_format(ReadAhead *r) {
+    return r->format == FORMAT_GZIP ? "gzip" : r->format == FORMAT_ZSTD ? "zstd" : "raw";
+}
+
+void readahead_stop(ReadAhead *r) {
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+    if (!r->done) {
+        pthread_cancel(r->thread);  // it may be blocked in read() on input nobody wants; acted on only there
+    }
+    pthread_join(r->thread, NULL);
+
+    if (r->format == FORMAT_GZIP) {
+        inflateEnd(&r->zs);
+    }
+#ifdef HAVE_ZSTD
+    if (r->zds != NULL) {
+        ZSTD_freeDStream(r->zds);
+    }
+#endif
+    for (int i = 0; i < READAHEAD_CHUNKS; i++) {
+        free(r->chunks[i].data);
+    }
+    free(r->in);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->changed);
+    free(r);
+}
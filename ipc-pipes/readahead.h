@@ -0,0 +1,19 @@
+/*
+Read-ahead input for pipesort: a thread fills a ring of large buffers from a
+file descriptor, inflating gzip (and zstd when built with libzstd) input on
+the way, while the tokenizer takes lines out with readahead_gets
+*/
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#define READAHEAD_CHUNKS 4            // buffers in the ring
+#define READAHEAD_CHUNK_SIZE (1 << 20) // bytes per buffer
+
+typedef struct ReadAhead ReadAhead;
+
+ReadAhead *readahead_start(int fd);
+char *readahead_gets(ReadAhead *r, char *buf, int size);
+const char *readahead_format(ReadAhead *r);
+void readahead_stop(ReadAhead *r);
+
+#endif
@@ -0,0 +1,206 @@
+#include "utf8.h"
+#include "utf8_tables.h"
+#include <stdint.h>
+#include <string.h>
+
+#define DIRECT_LIMIT 0x800  // 1- and 2-byte characters are looked up directly
+
+static unsigned char ascii_map[128];                // lowercase letter, digit or ' '
+static unsigned short direct_fold[DIRECT_LIMIT];   // folded code point, 0 if not a word char
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// Binary search of the word-character ranges
+static int is_word_cp(unsigned int cp) {
+    size_t lo = 0, hi = COUNT(utf8_word_ranges);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cp < utf8_word_ranges[mid][0]) {
+            hi = mid;
+        } else if (cp > utf8_word_ranges[mid][1]) {
+            lo = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Binary search of the folding runs; characters without a folding map to themselves
+static unsigned int fold_cp(unsigned int cp) {
+    size_t lo = 0, hi = COUNT(utf8_fold_runs);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cp < utf8_fold_runs[mid].lo) {
+            hi = mid;
+        } else if (cp > utf8_fold_runs[mid].hi) {
+            lo = mid + 1;
+        } else {
+            if ((cp - utf8_fold_runs[mid].lo) % utf8_fold_runs[mid].stride == 0) {
+                return cp + utf8_fold_runs[mid].delta;
+            }
+            return cp;
+        }
+    }
+    return cp;
+}
+
+void utf8_init(void) {
+    for (int c = 0; c < 128; c++) {
+        if (c >= 'A' && c <= 'Z') {
+            ascii_map[c] = c - 'A' + 'a';
+        } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            ascii_map[c] = c;
+        } else {
+            ascii_map[c] = ' ';
+        }
+    }
+    for (unsigned int cp = 0x80; cp < DIRECT_LIMIT; cp++) {
+        direct_fold[cp] = is_word_cp(cp) ? fold_cp(cp) : 0;
+    }
+}
+
+// Decode the sequence at s; returns its length, or 0 if it is invalid or cut short
+static int decode(const unsigned char *s, size_t len, unsigned int *cp) {
+    unsigned char c = s[0];
+    if (c < 0xC2) {
+        return 0;  // stray continuation byte or overlong form
+    }
+    if (c < 0xE0) {
+        if (len < 2 || (s[1] & 0xC0) != 0x80) return 0;
+        *cp = ((c & 0x1F) << 6) | (s[1] & 0x3F);
+        return 2;
+    }
+    if (c < 0xF0) {
+        if (len < 3 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80) return 0;
+        *cp = ((c & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+        if (*cp < 0x800 || (*cp >= 0xD800 && *cp <= 0xDFFF)) return 0;
+        return 3;
+    }
+    if (c < 0xF5) {
+        if (len < 4 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80) return 0;
+        *cp = ((c & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+        if (*cp < 0x10000 || *cp > 0x10FFFF) return 0;
+        return 4;
+    }
+    return 0;
+}
+
+static int encode(unsigned int cp, unsigned char *out) {
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+// Fold word characters and blank everything else; out needs UTF8_MAX_GROWTH * len bytes.
+// Returns the length written.
+size_t utf8_preprocess(const char *in, size_t len, char *out) {
+    const unsigned char *src = (const unsigned char *)in;
+    unsigned char *dst = (unsigned char *)out;
+    size_t i = 0, o = 0;
+
+    while (i < len) {
+        // Fast path: eight ASCII bytes at a time
+        while (i + 8 <= len) {
+            uint64_t chunk;
+            memcpy(&chunk, src + i, 8);
+            if (chunk & 0x8080808080808080ULL) {
+                break;
+            }
+            for (int k = 0; k < 8; k++) {
+                dst[o + k] = ascii_map[src[i + k]];
+            }
+            i += 8;
+            o += 8;
+        }
+        if (i >= len) {
+            break;
+        }
+
+        unsigned char c = src[i];
+        if (c < 0x80) {
+            dst[o++] = ascii_map[c];
+            i++;
+            continue;
+        }
+
+        unsigned int cp;
+        int n = decode(src + i, len - i, &cp);
+        if (n == 0) {
+            dst[o++] = ' ';  // invalid byte
+            i++;
+            continue;
+        }
+        i += n;
+
+        unsigned int folded;
+        if (cp < DIRECT_LIMIT) {
+            folded = direct_fold[cp];
+        } else {
+            folded = is_word_cp(cp) ? fold_cp(cp) : 0;
+        }
+        if (folded == 0) {
+            dst[o++] = ' ';  // punctuation, symbol, space or dash
+        } else {
+            o += encode(folded, dst + o);
+        }
+    }
+    return o;
+}
+
+// Number of characters in a valid UTF-8 string
+size_t utf8_length(const char *s) {
+    size_t n = 0;
+    for (; *s; s++) {
+        if (((unsigned char)*s & 0xC0) != 0x80) {
+            n++;
+        }
+    }
+    return n;
+}
+
+// Byte offset where character number `chars` starts (or the string's end)
+size_t utf8_offset(const char *s, size_t chars) {
+    size_t i = 0;
+    while (s[i]) {
+        if (((unsigned char)s[i] & 0xC0) != 0x80) {
+            if (chars == 0) {
+                break;
+            }
+            chars--;
+        }
+        i++;
+    }
+    return i;
+}
+
+// Bytes at the end of s that start a character whose remaining bytes have not been read yet
+size_t utf8_incomplete_tail(const char *s, size_t len) {
+    const unsigned char *u = (const unsigned char *)s;
+    for (size_t back = 1; back <= 3 && back <= len; back++) {
+        unsigned char c = u[len - back];
+        if ((c & 0xC0) == 0x80) {
+            continue;  // continuation byte, keep looking for the lead
+        }
+        size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return back < need ? back : 0;
+    }
+    return 0;
+}
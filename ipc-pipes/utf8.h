@@ -0,0 +1,22 @@
+/*
+UTF-8 tokenization for pipesort -u: word characters are Unicode letters,
+marks and decimal digits, folded with simple case folding; everything else
+becomes a space, like preprocess_input does for ASCII
+*/
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+
+#define UTF8_MAX_GROWTH 2   // folding can turn a 2-byte character into 3 bytes
+
+#define EN_DASH "\xE2\x80\x93"
+#define EM_DASH "\xE2\x80\x94"
+
+void utf8_init(void);
+size_t utf8_preprocess(const char *in, size_t len, char *out);
+size_t utf8_length(const char *s);
+size_t utf8_offset(const char *s, size_t chars);
+size_t utf8_incomplete_tail(const char *s, size_t len);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+/*
+Synthetic corpus generator for benchmarking pipesort.
+Word frequencies follow a Zipf distribution over a fixed vocabulary of
+made-up words; some words are capitalised or followed by punctuation so
+the tokenizer has real work to do. With -u about one word in five gets an
+accented letter, to exercise pipesort -u.
+
+  zipfgen [-w words] [-v vocabulary] [-l words per line] [-z exponent] [-r seed] [-u]
+*/
+
+#define MAX_GEN_WORD 32
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+// xorshift64, good enough for a benchmark corpus and identical everywhere
+static unsigned long long next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double next_uniform(void) {
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static const char *accented[] = {"\xC3\xA9", "\xC3\xBC", "\xC3\xB1", "\xC3\xA7", "\xC3\xB8", "\xC3\xA5"};
+
+// Word number i of the vocabulary: 2-12 lowercase letters derived from i
+static void make_word(unsigned long i, char *word, int utf8) {
+    unsigned long long h = (i + 1) * 0x9E3779B97F4A7C15ULL;
+    int len = 2 + (int)(h % 11);
+    int accent_at = (utf8 && (h >> 40) % 5 == 0) ? 1 + (int)((h >> 44) % (len - 1)) : -1;
+    char *out = word;
+    for (int k = 0; k < len; k++) {
+        h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+        if (k == accent_at) {
+            const char *a = accented[(h >> 33) % 6];
+            *out++ = a[0];
+            *out++ = a[1];
+        } else {
+            *out++ = 'a' + (char)((h >> 33) % 26);
+        }
+    }
+    *out = '\0';
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    long total_words = 1000000;
+    long vocabulary = 50000;
+    int line_words = 12;
+    double exponent = 1.0;
+    int utf8 = 0;
+
+    while ((opt = getopt(argc, argv, "w:v:l:z:r:u")) != -1) {
+        switch (opt) {
+            case 'w':
+                total_words = atol(optarg);
+                break;
+            case 'v':
+                vocabulary = atol(optarg);
+                break;
+            case 'l':
+                line_words = atoi(optarg);
+                break;
+            case 'z':
+                exponent = atof(optarg);
+                break;
+            case 'r':
+                rng_state = strtoull(optarg, NULL, 10) | 1;
+                break;
+            case 'u':
+                utf8 = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: zipfgen [-w words] [-v vocabulary] [-l words per line] [-z exponent] [-r seed] [-u]\n");
+                exit(1);
+        }
+    }
+    if (total_words < 0 || vocabulary <= 0 || line_words <= 0 || exponent <= 0) {
+        fprintf(stderr, "Invalid generator parameters\n");
+        exit(1);
+    }
+
+    // Cumulative Zipf weights, sampled by binary search
+    double *cdf = (double *)malloc(vocabulary * sizeof(double));
+    char (*words)[MAX_GEN_WORD] = malloc(vocabulary * MAX_GEN_WORD);
+    if (cdf == NULL || words == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    double sum = 0;
+    for (long i = 0; i < vocabulary; i++) {
+        sum += 1.0 / pow(i + 1, exponent);
+        cdf[i] = sum;
+        make_word(i, words[i], utf8);
+    }
+
+    for (long n = 0; n < total_words; n++) {
+        double u = next_uniform() * sum;
+        long lo = 0, hi = vocabulary - 1;
+        while (lo < hi) {
+            long mid = (lo + hi) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        unsigned long long r = next_random();
+        const char *w = words[lo];
+        if (r % 10 == 0) {
+            putchar(w[0] - 'a' + 'A');  // capitalised
+            fputs(w + 1, stdout);
+        } else {
+            fputs(w, stdout);
+        }
+        if ((r >> 8) % 12 == 0) {
+            putchar((r >> 16) % 2 ? ',' : '.');
+        }
+        putchar((n + 1) % line_words == 0 ? '\n' : ' ');
+    }
+    if (total_words % line_words != 0) {
+        putchar('\n');
+    }
+
+    free(cdf);
+    free(words);
+    return 0;
+}
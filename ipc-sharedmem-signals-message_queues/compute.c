@@ -1,4 +1,5 @@
 #include "defs.h"
+#include "prefilter.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,12 +8,30 @@
 #include <sys/sem.h>
 #include <sys/msg.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define BATCH_LANES 16               // candidates evaluated together by the batch kernel
+#define BATCH_LIMIT (1LL << 32)      // the batch kernel works on 32-bit lanes
+#define MAX_TRIAL_DIVISOR (1 << 16)  // sqrt(BATCH_LIMIT)
+#define TEST_SEGMENT (1 << 20)       // numbers per segment of the -T sieve
+
+#define PERF_BLOCK 4096             // candidate ranks between two reads of the -P counters
+
+#define KERNEL_SCALAR 0
+#define KERNEL_BATCH  1
 
 // Message structure for message q
 typedef struct {
     long msg_type;
     pid_t pid;
-    int perfect_num;
+    long long perfect_num;
 } Message;
 
 // Semaphore operations
@@ -26,13 +45,12 @@ void sem_unlock(int sem_id) {
     semop(sem_id, &sb, 1);
 }
 
-// Function to checkfor perfect number
-// based on the formula for calculating the sum of divisors of a number
-int is_perfect(int n) {
+// Sum of the proper divisors of n (0 for n < 2), pairing each divisor i <= sqrt(n) with n / i
+long long divisor_sum(long long n) {
     if (n < 2) return 0;
 
-    int sum = 1; 
-    for (int i = 2; i * i <= n; i++) {
+    long long sum = 1; 
+    for (long long i = 2; i * i <= n; i++) {
         if (n % i == 0) {
             if (i * i == n) {
                 sum += i;
@@ -41,17 +59,493 @@ int is_perfect(int n) {
             }
         }
     }
-    return sum == n;
+    return sum;
+}
+
+// Function to checkfor perfect number
+// based on the formula for calculating the sum of divisors of a number
+int is_perfect(long long n) {
+    return n >= 2 && divisor_sum(n) == n;
+}
+
+// Per-divisor constants for the batch kernel. With d = 2^shift * odd and inverse * odd = 1 (mod 2^32),
+// n < 2^32 is a multiple of d exactly when rotr(n * inverse, shift) <= limit = (2^32 - 1) / d,
+// and then n / d = (n >> shift) * inverse (mod 2^32) -- exact division by multiplication.
+typedef struct {
+    uint32_t inverse;
+    uint32_t shift;
+    uint32_t limit;
+} Divisor;
+
+static Divisor divisors[MAX_TRIAL_DIVISOR];
+
+void init_divisors(void) {
+    for (uint32_t d = 2; d < MAX_TRIAL_DIVISOR; d++) {
+        uint32_t shift = __builtin_ctz(d);
+        uint32_t odd = d >> shift;
+        uint32_t inverse = odd;  // Newton's iteration doubles the correct low bits each step
+        for (int i = 0; i < 4; i++) {
+            inverse *= 2 - odd * inverse;
+        }
+        divisors[d].inverse = inverse;
+        divisors[d].shift = shift;
+        divisors[d].limit = UINT32_MAX / d;
+    }
+}
+
+// Proper divisor sums of up to BATCH_LANES numbers below BATCH_LIMIT, one trial divisor at a time
+// across all lanes. The lane loop is 32-bit multiplies, rotates and compares with no divide, so
+// the compiler can keep it in vector registers; sums are only updated for lanes that d divides.
+void divisor_sums_batch(const long long *n, int count, long long *sums) {
+    uint32_t lane[BATCH_LANES];
+    uint64_t sum[BATCH_LANES];
+    uint32_t largest = 0;
+
+    for (int k = 0; k < BATCH_LANES; k++) {
+        lane[k] = k < count ? (uint32_t)n[k] : 0;
+        sum[k] = 1;
+        if (lane[k] > largest) {
+            largest = lane[k];
+        }
+    }
+
+    for (uint32_t d = 2; (uint64_t)d * d <= largest; d++) {
+        Divisor div = divisors[d];
+        uint32_t square = d * d;
+        uint32_t hit[BATCH_LANES];
+        uint32_t any = 0;
+        for (int k = 0; k < BATCH_LANES; k++) {
+            uint32_t x = lane[k] * div.inverse;
+            x = (x >> div.shift) | (x << ((32 - div.shift) & 31));
+            hit[k] = (x <= div.limit) & (square <= lane[k]);
+            any |= hit[k];
+        }
+        if (any) {
+            for (int k = 0; k < BATCH_LANES; k++) {
+                if (hit[k]) {
+                    uint32_t q = (lane[k] >> div.shift) * div.inverse;
+                    sum[k] += q == d ? d : (uint64_t)d + q;
+                }
+            }
+        }
+    }
+
+    for (int k = 0; k < count; k++) {
+        sums[k] = n[k] < 2 ? 0 : (long long)sum[k];
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// -T: check both kernels against a segmented sieve of divisor sums for every prefilter candidate
+// below limit. Returns the number of mismatches.
+int test_kernels(int mode, long long limit) {
+    long long *sigma = (long long *)malloc(TEST_SEGMENT * sizeof(long long));
+    if (sigma == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    init_divisors();
+
+    long long checked = 0;
+    int mismatches = 0;
+    double batch_time = 0, scalar_time = 0;
+    long long batch[BATCH_LANES], sums[BATCH_LANES];
+
+    for (long long lo = 1; lo < limit; lo += TEST_SEGMENT) {
+        long long hi = lo + TEST_SEGMENT < limit ? lo + TEST_SEGMENT : limit;
+
+        // sigma(m) for m in [lo, hi): every divisor pair (d, k) with d <= k and d * k = m
+        memset(sigma, 0, (hi - lo) * sizeof(long long));
+        for (long long d = 1; d * d < hi; d++) {
+            long long k = (lo + d - 1) / d > d ? (lo + d - 1) / d : d;
+            for (long long m = d * k; m < hi; m += d, k++) {
+                sigma[m - lo] += k == d ? d : d + k;
+            }
+        }
+
+        long long m = lo;
+        while (m < hi) {
+            int count = 0;
+            while (count < BATCH_LANES && m < hi) {
+                if (prefilter_accepts(mode, m)) {
+                    batch[count++] = m;
+                }
+                m++;
+            }
+            if (count == 0) {
+                continue;
+            }
+
+            double t = now_seconds();
+            divisor_sums_batch(batch, count, sums);
+            batch_time += now_seconds() - t;
+
+            for (int k = 0; k < count; k++) {
+                long long expected = sigma[batch[k] - lo] - batch[k];
+                t = now_seconds();
+                long long scalar = divisor_sum(batch[k]);
+                scalar_time += now_seconds() - t;
+                if (sums[k] != expected || scalar != expected) {
+                    fprintf(stderr, "Mismatch at %lld: sieve %lld, batch %lld, scalar %lld\n",
+                            batch[k], expected, sums[k], scalar);
+                    mismatches++;
+                }
+            }
+            checked += count;
+        }
+    }
+
+    printf("Kernel test below %lld (%s prefilter): %lld numbers checked, %d mismatches\n",
+           limit, prefilter_name(mode), checked, mismatches);
+    printf("  batch  %.3f s\n  scalar %.3f s\n", batch_time, scalar_time);
+    free(sigma);
+    return mismatches;
+}
+
+
+// -V: run the full test on a sample of the numbers the prefilter rejects in [start, start + RANGE_SIZE),
+// and check that rank and unrank agree on every candidate. Returns the number of problems found.
+int verify_prefilter(int mode, long long start, long sample) {
+    long long end = start + RANGE_SIZE;
+    long long first = prefilter_first_rank(mode, start);
+    long long rejected = RANGE_SIZE - (prefilter_first_rank(mode, end) - first);
+    long long stride = rejected / sample > 1 ? rejected / sample : 1;
+
+    long long checked = 0, seen = 0;
+    int false_negatives = 0, rank_errors = 0;
+    long long next_rank = first;
+    for (long long n = start; n < end; n++) {
+        if (prefilter_accepts(mode, n)) {
+            if (prefilter_rank(mode, n) != next_rank || prefilter_unrank(mode, next_rank) != n) {
+                fprintf(stderr, "Rank mismatch at %lld\n", n);
+                rank_errors++;
+            }
+            next_rank++;
+        } else if (seen++ % stride == 0) {
+            checked++;
+            if (is_perfect(n)) {
+                fprintf(stderr, "False negative: %lld is perfect but was filtered out\n", n);
+                false_negatives++;
+            }
+        }
+    }
+
+    printf("Prefilter %s on [%lld, %lld): %lld candidates, %lld rejected, %lld rejected numbers tested, "
+           "%d false negatives, %d rank errors\n",
+           prefilter_name(mode), start, end, next_rank - first, rejected, checked, false_negatives, rank_errors);
+    return false_negatives + rank_errors;
+}
+
+
+// -P: cycles, instructions, branch misses and LLC misses of this process, opened as one group
+// so every read covers the same interval. Counters the kernel or CPU refuses are left out.
+#define PERF_EVENTS 4
+
+static const unsigned long long perf_configs[PERF_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_MISSES,  // last-level cache misses on most CPUs
+};
+
+typedef struct {
+    int leader;                               // -1 when no counter is available
+    int opened;                               // PERF_* bits
+    int count;                                // values in a group read
+    int event[PERF_EVENTS];                   // which counter each value is
+    unsigned long long last[PERF_EVENTS];     // totals at the previous read
+} PerfGroup;
+
+void perf_open(PerfGroup *g) {
+    g->leader = -1;
+    g->opened = 0;
+    g->count = 0;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_configs[e];
+        attr.disabled = g->leader < 0;
+        attr.exclude_kernel = 1;  // allowed at perf_event_paranoid 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, g->leader, 0);
+        if (fd < 0) {
+            continue;
+        }
+        if (g->leader < 0) {
+            g->leader = fd;
+        }
+        g->event[g->count] = e;
+        g->last[g->count] = 0;
+        g->count++;
+        g->opened |= 1 << e;
+    }
+
+    if (g->leader < 0) {
+        perror("perf_event_open (running without counters)");
+        return;
+    }
+    ioctl(g->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Counter deltas since the previous read, by PERF_* bit position; scaled up if the group was multiplexed
+void perf_read(PerfGroup *g, unsigned long long delta[PERF_EVENTS]) {
+    unsigned long long data[3 + PERF_EVENTS];
+    memset(delta, 0, PERF_EVENTS * sizeof(unsigned long long));
+    if (g->leader < 0 || read(g->leader, data, sizeof(data)) < (ssize_t)(3 * sizeof(unsigned long long))) {
+        return;
+    }
+    unsigned long long enabled = data[1], running = data[2];
+    for (int k = 0; k < g->count && k < (int)data[0]; k++) {
+        unsigned long long total = data[3 + k];
+        if (running > 0 && running < enabled) {
+            total = (unsigned long long)((double)total * enabled / running);
+        }
+        delta[g->event[k]] = total - g->last[k];
+        g->last[k] = total;
+    }
+}
+
+// Add one block's counter deltas to this process's slot
+void perf_publish(PerfGroup *g, SharedMemory *shared_mem, int process_index, int sem_id) {
+    unsigned long long delta[PERF_EVENTS];
+    perf_read(g, delta);
+
+    sem_lock(sem_id);
+    Process *p = &shared_mem->processes[process_index];
+    p->perf_blocks++;
+    p->cycles += delta[0];
+    p->instructions += delta[1];
+    p->branch_misses += delta[2];
+    p->llc_misses += delta[3];
+    sem_unlock(sem_id);
+}
+
+// Send a perfect number to manage and count it for this process
+void report_perfect(SharedMemory *shared_mem, int process_index, int msg_id, long long n) {
+    shared_mem->processes[process_index].perfect_count++; 
+    // Send perfect number to manage
+    Message msg;
+    msg.msg_type = 2;       // will mark perfect numbers msg type
+    msg.pid = getpid();     
+    msg.perfect_num = n;   
+
+    if (msgsnd(msg_id, &msg, sizeof(Message) - sizeof(long), 0) == -1) { 
+        perror("msgsnd failed");
+        exit(1);
+    }
+}
+
+// Run the batch kernel over the collected candidates and report the perfect ones
+void test_batch(SharedMemory *shared_mem, int process_index, int msg_id, const long long *batch, int count) {
+    long long sums[BATCH_LANES];
+    divisor_sums_batch(batch, count, sums);
+    for (int k = 0; k < count; k++) {
+        if (batch[k] >= 2 && sums[k] == batch[k]) {
+            report_perfect(shared_mem, process_index, msg_id, batch[k]);
+        }
+    }
+}
+
+// Test every candidate of [start, start + RANGE_SIZE) without shared memory, for a remote worker.
+// Stores up to max_found perfect numbers and returns how many there were.
+int search_range(int mode, int kernel, long long start, long long *found, int max_found, long long *tested) {
+    long long batch[BATCH_LANES], sums[BATCH_LANES];
+    int batched = 0, count = 0;
+    long long first = prefilter_first_rank(mode, start);
+    long long last = prefilter_first_rank(mode, start + RANGE_SIZE);
+
+    for (long long r = first; r <= last; r++) {
+        // r == last only flushes the final partial batch
+        if (r < last) {
+            long long n = prefilter_unrank(mode, r);
+            if (kernel == KERNEL_BATCH && n < BATCH_LIMIT) {
+                batch[batched++] = n;
+            } else if (is_perfect(n) && count < max_found) {
+                found[count++] = n;
+            }
+        }
+        if (batched == BATCH_LANES || (r == last && batched > 0)) {
+            divisor_sums_batch(batch, batched, sums);
+            for (int k = 0; k < batched; k++) {
+                if (batch[k] >= 2 && sums[k] == batch[k] && count < max_found) {
+                    found[count++] = batch[k];
+                }
+            }
+            batched = 0;
+        }
+    }
+    *tested = last - first;
+    return count;
+}
+
+// -c: lease ranges from a manage coordinator over TCP until it has none left
+int run_remote(const char *address, int kernel) {
+    char host[256];
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL || colon == address || (size_t)(colon - address) >= sizeof(host)) {
+        fprintf(stderr, "Coordinator address must be HOST:PORT\n");
+        exit(1);
+    }
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, colon + 1, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+        exit(1);
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        perror("connect");
+        exit(1);
+    }
+
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    if (in == NULL || out == NULL) {
+        perror("fdopen");
+        exit(1);
+    }
+    init_divisors();
+    fprintf(out, "HELLO %d\nLEASE\n", getpid());
+    fflush(out);
+
+    char line[MAX_REMOTE_LINE];
+    int ranges = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        long long start;
+        int mode;
+        if (strcmp(line, "DONE\n") == 0) {
+            break;
+        } else if (strcmp(line, "WAIT\n") == 0) {
+            sleep(1);  // every range is leased; one may come back if its worker is lost
+            fprintf(out, "LEASE\n");
+        } else if (sscanf(line, "RANGE %lld %d", &start, &mode) == 2) {
+            long long found[MAX_PERFECT_NUMS], tested;
+            int count = search_range(mode, kernel, start, found, MAX_PERFECT_NUMS, &tested);
+
+            // One report per range carries all its results and asks for the next lease
+            fprintf(out, "REPORT %lld %lld %lld %d", start, tested, RANGE_SIZE - tested, count);
+            for (int i = 0; i < count; i++) {
+                fprintf(out, " %lld", found[i]);
+            }
+            fprintf(out, "\n");
+            ranges++;
+        } else {
+            fprintf(stderr, "Unexpected reply from coordinator: %s", line);
+            break;
+        }
+        fflush(out);
+        if (ferror(out)) {
+            break;
+        }
+    }
+
+    printf("Worker %d: %d ranges\n", getpid(), ranges);
+    fclose(in);
+    fclose(out);
+    return 0;
+}
+
+void print_usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-k scalar|batch] [-P] [-V SAMPLE] START\n"
+                    "       %s [-k scalar|batch] -c HOST:PORT\n"
+                    "       %s -T LIMIT [-f none|even|wheel]\n", name, name, name);
 }
 
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s START\n", argv[0]);
+    int opt;
+    long sample = 0;
+    int kernel = KERNEL_BATCH;
+    long long test_limit = 0;
+    int test_mode = PREFILTER_NONE;
+    const char *coordinator = NULL;
+    int use_perf = 0;
+
+    while ((opt = getopt(argc, argv, "V:k:T:f:c:P")) != -1) {
+        switch (opt) {
+            case 'V': // verify the prefilter on a sample of rejected numbers instead of computing
+                sample = atol(optarg);
+                if (sample <= 0) {
+                    fprintf(stderr, "Invalid sample size\n");
+                    exit(1);
+                }
+                break;
+            case 'k': // divisor-sum kernel: one number at a time, or BATCH_LANES together
+                if (strcmp(optarg, "scalar") == 0) {
+                    kernel = KERNEL_SCALAR;
+                } else if (strcmp(optarg, "batch") == 0) {
+                    kernel = KERNEL_BATCH;
+                } else {
+                    fprintf(stderr, "Unknown kernel: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'T': // check the kernels against a divisor-sum sieve below LIMIT
+                test_limit = atoll(optarg);
+                if (test_limit <= 0 || test_limit > BATCH_LIMIT) {
+                    fprintf(stderr, "Invalid test limit (1 to %lld)\n", BATCH_LIMIT);
+                    exit(1);
+                }
+                break;
+            case 'f': // -T only: test just the candidates of this prefilter
+                test_mode = prefilter_parse(optarg);
+                if (test_mode < 0) {
+                    fprintf(stderr, "Unknown prefilter: %s (none, even or wheel)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'P': // publish hardware counter readings in the process slot
+                use_perf = 1;
+                break;
+            case 'c': // remote worker: take ranges from a manage coordinator over TCP
+                coordinator = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (test_limit > 0) {
+        return test_kernels(test_mode, test_limit) == 0 ? 0 : 1;
+    }
+    if (coordinator != NULL) {
+        return run_remote(coordinator, kernel);
+    }
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
         exit(1);
     }
 
-    int start = atoi(argv[1]);
+    long long start = atoll(argv[optind]);
+    if (start < 0) {
+        fprintf(stderr, "Invalid start\n");
+        exit(1);
+    }
 
     // Access shared memory
     int shm_id = shmget(SHM_KEY, sizeof(SharedMemory), 0666);
@@ -64,6 +558,18 @@ int main(int argc, char *argv[]) {
         perror("shmat failed");
         exit(1);
     }
+    int mode = shared_mem->prefilter;
+
+    if (sample > 0) {
+        return verify_prefilter(mode, start, sample) == 0 ? 0 : 1;
+    }
+
+    // Access semaphore
+    int sem_id = semget(SEM_KEY, 1, 0666);
+    if (sem_id == -1) {
+        perror("semget failed");
+        exit(1);
+    }
     
     // Access message queue
     int msg_id = msgget(MSG_KEY, 0666);
@@ -72,6 +578,15 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    // Only candidates that pass the prefilter have a bit in the bitmap
+    long long first = prefilter_first_rank(mode, start);
+    long long last = prefilter_first_rank(mode, start + RANGE_SIZE);
+    if (last > BITMAP_BITS) {
+        fprintf(stderr, "Range is beyond the bitmap: the %s prefilter tracks numbers below %lld\n",
+                prefilter_name(mode), prefilter_unrank(mode, BITMAP_BITS));
+        exit(1);
+    }
+
     // Get process index
     int process_index = -1;
     for (int i = 0; i < MAX_PROCESSES; i++) {
@@ -88,34 +603,58 @@ int main(int argc, char *argv[]) {
 
     // printf("Compute process started. PID: %d\n", getpid());
 
+    sem_lock(sem_id);
+    shared_mem->processes[process_index].filtered_count += RANGE_SIZE - (last - first);
+    sem_unlock(sem_id);
+
+    if (kernel == KERNEL_BATCH) {
+        init_divisors();
+    }
+    long long batch[BATCH_LANES];
+    int batched = 0;
+
+    PerfGroup perf = {.leader = -1};
+    if (use_perf) {
+        perf_open(&perf);
+        shared_mem->processes[process_index].perf_counters = perf.opened;
+    }
+
     // Update statistics
     while (1) {
-        for (int i = start; i < start + 1000000; i++) {
-            sem_lock(shm_id);
-            if ((shared_mem->bitmap[i / 8] & (1 << (i % 8))) == 0) {
-                shared_mem->bitmap[i / 8] |= (1 << (i % 8));
+        for (long long r = first; r < last; r++) {
+            if (perf.leader >= 0 && r > first && (r - first) % PERF_BLOCK == 0) {
+                perf_publish(&perf, shared_mem, process_index, sem_id);
+            }
+            long long i = prefilter_unrank(mode, r);
+            sem_lock(sem_id);
+            if ((shared_mem->bitmap[r / 8] & (1 << (r % 8))) == 0) {
+                shared_mem->bitmap[r / 8] |= (1 << (r % 8));
                 shared_mem->processes[process_index].tested_count++;
-                sem_unlock(shm_id);
-
-                if (is_perfect(i)) {
-                    shared_mem->processes[process_index].perfect_count++; 
-                    // Send perfect number to manage
-                    Message msg;
-                    msg.msg_type = 2;       // will mark perfect numbers msg type
-                    msg.pid = getpid();     
-                    msg.perfect_num = i;   
-
-                    if (msgsnd(msg_id, &msg, sizeof(Message) - sizeof(long), 0) == -1) { 
-                        perror("msgsnd failed");
-                        exit(1);
+                sem_unlock(sem_id);
+
+                // Claimed candidates queue up for the batch kernel; numbers past its range use the scalar test
+                if (kernel == KERNEL_BATCH && i < BATCH_LIMIT) {
+                    batch[batched++] = i;
+                    if (batched == BATCH_LANES) {
+                        test_batch(shared_mem, process_index, msg_id, batch, batched);
+                        batched = 0;
                     }
+                } else if (is_perfect(i)) {
+                    report_perfect(shared_mem, process_index, msg_id, i);
                 }
             } else {
                 shared_mem->processes[process_index].skipped_count++;
-                sem_unlock(shm_id);
+                sem_unlock(sem_id);
             }
         }
 
+        if (batched > 0) {
+            test_batch(shared_mem, process_index, msg_id, batch, batched);
+        }
+        if (perf.leader >= 0) {
+            perf_publish(&perf, shared_mem, process_index, sem_id);
+            close(perf.leader);
+        }
         break;
     }
 
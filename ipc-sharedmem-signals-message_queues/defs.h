@@ -14,6 +14,24 @@ This header file defines the constants, structures, and keys shared between mana
 #define MAX_PROCESSES 20
 #define MAX_PERFECT_NUMS 20
 #define BITMAP_SIZE (1 << 22)  // 2^22 bytes
+#define BITMAP_BITS (8LL * BITMAP_SIZE)  // candidate ranks the bitmap can track
+#define RANGE_SIZE 1000000     // numbers covered by one compute run
+
+/*
+TCP protocol between the manage coordinator (-p PORT) and remote compute workers (-c HOST:PORT),
+one text line per message:
+  worker:      HELLO <pid>, then LEASE
+  coordinator: RANGE <start> <prefilter>, WAIT (all ranges leased, ask again later) or DONE
+  worker:      REPORT <start> <tested> <filtered> <count> <perfect>... which also asks for the next lease
+*/
+#define LEASE_TIMEOUT 30       // seconds before an unreported range goes back in the queue
+#define MAX_REMOTE_LINE 1024
+
+// Hardware counters a compute -P worker managed to open (Process.perf_counters)
+#define PERF_CYCLES        1
+#define PERF_INSTRUCTIONS  2
+#define PERF_BRANCH_MISSES 4
+#define PERF_LLC_MISSES    8
 
 // Process structure
 typedef struct {
@@ -21,14 +39,23 @@ typedef struct {
     int perfect_count;
     int tested_count;
     int skipped_count;
+    int filtered_count;   // rejected by the prefilter without testing
+    int remote;           // a TCP worker, counted by the manage coordinator
+    int perf_counters;    // PERF_* bits, 0 when the worker runs without counters
+    unsigned long long perf_blocks;   // blocks measured; each adds its counter deltas below
+    unsigned long long cycles;
+    unsigned long long instructions;
+    unsigned long long branch_misses;
+    unsigned long long llc_misses;
 } Process;
 
 // Shared memory structure
 typedef struct {
-    unsigned char bitmap[BITMAP_SIZE];
-    int perfect_numbers[MAX_PERFECT_NUMS];
+    unsigned char bitmap[BITMAP_SIZE];  // indexed by candidate rank, see prefilter.h
+    long long perfect_numbers[MAX_PERFECT_NUMS];
     Process processes[MAX_PROCESSES];
     int manage_pid;
+    int prefilter;   // PREFILTER_* mode chosen by manage
     Process terminated_stats;
 } SharedMemory;
 
@@ -1,4 +1,5 @@
 #include "defs.h"
+#include "prefilter.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,12 +10,20 @@
 #include <sys/msg.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 
 // Message structure for the message queue
 typedef struct {
     long msg_type;
     pid_t pid;
-    int perfect_num;
+    long long perfect_num;
 } Message;
 
 // Global variables for cleanup
@@ -32,6 +41,321 @@ void sem_unlock(int sem_id) {
     semop(sem_id, &sb, 1);
 }
 
+// Record a perfect number once; the caller holds the semaphore
+void add_perfect(long long n) {
+    for (int i = 0; i < MAX_PERFECT_NUMS; i++) {
+        if (shared_mem->perfect_numbers[i] == n) {
+            break;  // a remote range can overlap numbers a local compute already tested
+        }
+        if (shared_mem->perfect_numbers[i] == 0) {
+            shared_mem->perfect_numbers[i] = n;
+            printf("Perfect number: %lld\n", n);
+            break;
+        }
+    }
+}
+
+// Coordinator (-p): ranges of RANGE_SIZE numbers from lease_start, leased to TCP workers
+#define RANGE_PENDING 0
+#define RANGE_LEASED  1
+#define RANGE_DONE    2
+
+typedef struct {
+    int state;
+    int fd;            // worker holding the lease
+    time_t deadline;   // back in the queue if not reported by then
+} Lease;
+
+typedef struct {
+    int fd;                // -1 for a free entry
+    int process_index;     // slot in shared_mem->processes once the worker said HELLO
+    char buf[MAX_REMOTE_LINE];
+    size_t len;
+} Worker;
+
+int coordinator_port = 0;
+int lease_timeout = LEASE_TIMEOUT;
+long long lease_start = 0;
+long range_count = 0;      // ranges to hand out
+long ranges_done = 0;
+Lease *leases;
+Worker workers[MAX_PROCESSES];
+struct timespec coordinator_started;
+
+static void send_line(int fd, const char *fmt, ...) {
+    char line[MAX_REMOTE_LINE];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    for (int off = 0; off < len; ) {
+        ssize_t n = write(fd, line + off, len - off);
+        if (n <= 0) {
+            return;  // the worker is gone; poll reports the hangup
+        }
+        off += n;
+    }
+}
+
+// Have local compute processes already tested every candidate of range idx? Caller holds the semaphore.
+static int range_covered(long idx) {
+    int mode = shared_mem->prefilter;
+    long long start = lease_start + idx * (long long)RANGE_SIZE;
+    long long last = prefilter_first_rank(mode, start + RANGE_SIZE);
+    for (long long r = prefilter_first_rank(mode, start); r < last; r++) {
+        if ((shared_mem->bitmap[r / 8] & (1 << (r % 8))) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void finish_range(long idx) {
+    leases[idx].state = RANGE_DONE;
+    if (++ranges_done == range_count) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        printf("Coordinator: all %ld ranges done in %.2f s\n", range_count,
+               (now.tv_sec - coordinator_started.tv_sec) + (now.tv_nsec - coordinator_started.tv_nsec) / 1e9);
+        fflush(stdout);
+    }
+}
+
+// Lease the first pending range to the worker on fd, skipping ranges covered locally
+static void send_lease(int fd) {
+    for (long idx = 0; idx < range_count; idx++) {
+        if (leases[idx].state != RANGE_PENDING) {
+            continue;
+        }
+        sem_lock(sem_id);
+        int covered = range_covered(idx);
+        sem_unlock(sem_id);
+        if (covered) {
+            finish_range(idx);
+            continue;
+        }
+        leases[idx].state = RANGE_LEASED;
+        leases[idx].fd = fd;
+        leases[idx].deadline = time(NULL) + lease_timeout;
+        send_line(fd, "RANGE %lld %d\n", lease_start + idx * (long long)RANGE_SIZE, shared_mem->prefilter);
+        return;
+    }
+    send_line(fd, ranges_done == range_count ? "DONE\n" : "WAIT\n");
+}
+
+// A worker finished a range: fold its batch of results into shared memory
+static void handle_report(Worker *w, char *args) {
+    long long start, tested, filtered;
+    int count, used;
+    if (sscanf(args, "%lld %lld %lld %d%n", &start, &tested, &filtered, &count, &used) != 4 ||
+        start < lease_start || (start - lease_start) % RANGE_SIZE != 0 ||
+        (start - lease_start) / RANGE_SIZE >= range_count) {
+        fprintf(stderr, "Coordinator: bad report: %s\n", args);
+        return;
+    }
+    long idx = (start - lease_start) / RANGE_SIZE;
+    if (leases[idx].state == RANGE_DONE) {
+        return;  // reported after its lease expired and someone else finished it
+    }
+
+    int mode = shared_mem->prefilter;
+    sem_lock(sem_id);
+    long long last = prefilter_first_rank(mode, start + RANGE_SIZE);
+    for (long long r = prefilter_first_rank(mode, start); r < last; r++) {
+        shared_mem->bitmap[r / 8] |= (1 << (r % 8));
+    }
+    if (w->process_index >= 0) {
+        Process *p = &shared_mem->processes[w->process_index];
+        p->tested_count += tested;
+        p->filtered_count += filtered;
+        p->perfect_count += count;
+    }
+    char *rest = args + used;
+    for (int i = 0; i < count; i++) {
+        long long n;
+        if (sscanf(rest, "%lld%n", &n, &used) != 1) {
+            break;
+        }
+        rest += used;
+        add_perfect(n);
+    }
+    sem_unlock(sem_id);
+    fflush(stdout);
+    finish_range(idx);
+}
+
+static void handle_line(Worker *w, char *line) {
+    if (strncmp(line, "HELLO ", 6) == 0 && w->process_index < 0) {
+        pid_t pid = atoi(line + 6);
+        sem_lock(sem_id);
+        // A remote slot already under this pid first, so a repeated HELLO does not take another
+        for (int i = 0; i < MAX_PROCESSES && w->process_index < 0; i++) {
+            if (shared_mem->processes[i].remote && shared_mem->processes[i].pid == pid) {
+                w->process_index = i;
+            }
+        }
+        for (int i = 0; i < MAX_PROCESSES && w->process_index < 0; i++) {
+            if (shared_mem->processes[i].pid == 0) {
+                shared_mem->processes[i].pid = pid;
+                shared_mem->processes[i].remote = 1;
+                w->process_index = i;
+            }
+        }
+        sem_unlock(sem_id);
+    } else if (strcmp(line, "LEASE") == 0) {
+        send_lease(w->fd);
+    } else if (strncmp(line, "REPORT ", 7) == 0) {
+        handle_report(w, line + 7);
+        send_lease(w->fd);
+    } else {
+        fprintf(stderr, "Coordinator: unknown request: %s\n", line);
+    }
+}
+
+// Requeue every lease held by a worker that went away, or that ran out of time
+static void requeue_leases(int fd, time_t now) {
+    for (long idx = 0; idx < range_count; idx++) {
+        if (leases[idx].state == RANGE_LEASED && (leases[idx].fd == fd || leases[idx].deadline < now)) {
+            printf("Coordinator: range %lld requeued\n", lease_start + idx * (long long)RANGE_SIZE);
+            fflush(stdout);
+            leases[idx].state = RANGE_PENDING;
+        }
+    }
+}
+
+// Give a disconnected worker's slot back for local compute and later workers.
+// Its counts move to terminated_stats so the report totals keep them.
+static void release_slot(Worker *w) {
+    if (w->process_index < 0) {
+        return;
+    }
+    sem_lock(sem_id);
+    Process *p = &shared_mem->processes[w->process_index];
+    shared_mem->terminated_stats.perfect_count += p->perfect_count;
+    shared_mem->terminated_stats.tested_count += p->tested_count;
+    shared_mem->terminated_stats.skipped_count += p->skipped_count;
+    shared_mem->terminated_stats.filtered_count += p->filtered_count;
+    memset(p, 0, sizeof(*p));
+    sem_unlock(sem_id);
+    w->process_index = -1;
+}
+
+// Coordinator thread: one poll loop over the listening socket and every worker connection
+void *coordinator_main(void *arg) {
+    int listen_fd = *(int *)arg;
+    struct pollfd fds[MAX_PROCESSES + 1];
+
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        workers[i].fd = -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &coordinator_started);
+
+    while (1) {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < MAX_PROCESSES; i++) {
+            fds[i + 1].fd = workers[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, MAX_PROCESSES + 1, 1000) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        requeue_leases(-1, time(NULL));
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            int slot = -1;
+            for (int i = 0; i < MAX_PROCESSES && fd >= 0; i++) {
+                if (workers[i].fd < 0) {
+                    slot = i;
+                    break;
+                }
+            }
+            if (slot < 0) {
+                if (fd >= 0) {
+                    close(fd);  // no room for another worker
+                }
+            } else {
+                workers[slot].fd = fd;
+                workers[slot].process_index = -1;
+                workers[slot].len = 0;
+            }
+        }
+
+        for (int i = 0; i < MAX_PROCESSES; i++) {
+            Worker *w = &workers[i];
+            if (w->fd < 0 || fds[i + 1].fd != w->fd || !(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            ssize_t n = read(w->fd, w->buf + w->len, sizeof(w->buf) - 1 - w->len);
+            if (n <= 0 || (w->len += n) == sizeof(w->buf) - 1) {
+                // Lost worker (or a line too long to be ours): give its ranges to someone else
+                requeue_leases(w->fd, 0);
+                release_slot(w);
+                close(w->fd);
+                w->fd = -1;
+                continue;
+            }
+            w->buf[w->len] = '\0';
+            char *line = w->buf, *newline;
+            while ((newline = strchr(line, '\n')) != NULL) {
+                *newline = '\0';
+                handle_line(w, line);
+                line = newline + 1;
+            }
+            w->len -= line - w->buf;
+            memmove(w->buf, line, w->len);
+        }
+    }
+    return NULL;
+}
+
+// Listen on port and run the coordinator next to the message loop
+void start_coordinator(long ranges) {
+    int mode = shared_mem->prefilter;
+
+    // Only ranges whose candidates all fit in the bitmap can be leased
+    long limit = 0;
+    while (prefilter_first_rank(mode, lease_start + (limit + 1) * (long long)RANGE_SIZE) <= BITMAP_BITS) {
+        limit++;
+    }
+    range_count = ranges > 0 && ranges < limit ? ranges : limit;
+    leases = (Lease *)calloc(range_count > 0 ? range_count : 1, sizeof(Lease));
+    if (leases == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(coordinator_port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, MAX_PROCESSES) < 0) {
+        perror("bind");
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    static int fd;
+    fd = listen_fd;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, coordinator_main, &fd) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    printf("Coordinator: leasing %ld ranges from %lld on port %d\n", range_count, lease_start, coordinator_port);
+    fflush(stdout);
+}
+
 // Signal handler to clean up resources
 void handle_signal(int sig) {
     printf("Cleaning up IPC resources\n");
@@ -42,8 +366,54 @@ void handle_signal(int sig) {
 }
 
 
-int main() {
+int main(int argc, char *argv[]) {
     key_t shm_key = SHM_KEY, sem_key = SEM_KEY, msg_key = MSG_KEY;
+    int opt;
+    int prefilter = PREFILTER_WHEEL;
+    long ranges = 0;
+
+    while ((opt = getopt(argc, argv, "f:p:s:n:t:")) != -1) {
+        switch (opt) {
+            case 'f': // candidate prefilter used by every compute process
+                prefilter = prefilter_parse(optarg);
+                if (prefilter < 0) {
+                    fprintf(stderr, "Unknown prefilter: %s (none, even or wheel)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'p': // also coordinate remote compute workers over TCP
+                coordinator_port = atoi(optarg);
+                if (coordinator_port <= 0 || coordinator_port > 65535) {
+                    fprintf(stderr, "Invalid port\n");
+                    exit(1);
+                }
+                break;
+            case 's': // first number of the leased ranges
+                lease_start = atoll(optarg);
+                if (lease_start < 0) {
+                    fprintf(stderr, "Invalid start\n");
+                    exit(1);
+                }
+                break;
+            case 'n': // number of ranges to lease (default: as far as the bitmap reaches)
+                ranges = atol(optarg);
+                if (ranges <= 0) {
+                    fprintf(stderr, "Invalid range count\n");
+                    exit(1);
+                }
+                break;
+            case 't': // lease timeout in seconds
+                lease_timeout = atoi(optarg);
+                if (lease_timeout <= 0) {
+                    fprintf(stderr, "Invalid lease timeout\n");
+                    exit(1);
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f none|even|wheel] [-p PORT [-s START] [-n RANGES] [-t SECONDS]]\n", argv[0]);
+                exit(1);
+        }
+    }
 
     // Set up shared memory
     shm_id = shmget(shm_key, sizeof(SharedMemory), IPC_CREAT | 0666);
@@ -75,6 +445,7 @@ int main() {
     // Initialize shared memory
     memset(shared_mem, 0, sizeof(SharedMemory));
     shared_mem->manage_pid = getpid();
+    shared_mem->prefilter = prefilter;
 
     // Signal handling
     signal(SIGINT, handle_signal);
@@ -89,6 +460,13 @@ int main() {
         shared_mem->processes[i].perfect_count = 0;
         shared_mem->processes[i].tested_count = 0;
         shared_mem->processes[i].skipped_count = 0;
+        shared_mem->processes[i].filtered_count = 0;
+        shared_mem->processes[i].remote = 0;
+    }
+    memset(&shared_mem->terminated_stats, 0, sizeof(shared_mem->terminated_stats));
+
+    if (coordinator_port > 0) {
+        start_coordinator(ranges);
     }
 
     Message msg;
@@ -98,13 +476,7 @@ int main() {
             sem_lock(sem_id);
             if (msg.msg_type == 2) { // Perfect number report using the message type 2
                 // Add the reported perfect number to shared memory
-                for (int i = 0; i < MAX_PERFECT_NUMS; i++) {
-                    if (shared_mem->perfect_numbers[i] == 0) {
-                        shared_mem->perfect_numbers[i] = msg.perfect_num;
-                        printf("Perfect number: %d\n", msg.perfect_num);
-                        break;
-                    }
-                }
+                add_perfect(msg.perfect_num);
             }
             sem_unlock(sem_id);
         }
@@ -0,0 +1,110 @@
+/*
+Candidate prefilter shared by manage.c, compute.c and report.c.
+The bitmap in shared memory is indexed by candidate rank rather than by number,
+so a filter that keeps fewer candidates also stretches the bitmap over more numbers.
+
+  none   every integer
+  even   even integers; no odd perfect number exists below 10^1500
+  wheel  6, plus n = 2^(p-1)(2^p-1) for odd prime p: such n are multiples of 4 ending in
+         16, 28, 36, 56, 76 or 96 with digital root 1, which leaves 6 residues mod 900
+*/
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include <string.h>
+
+#define PREFILTER_NONE  0
+#define PREFILTER_EVEN  1
+#define PREFILTER_WHEEL 2
+
+#define WHEEL_MODULUS 900
+#define WHEEL_RESIDUES 6
+
+static const int wheel_residues[WHEEL_RESIDUES] = {28, 136, 316, 496, 676, 856};
+
+// Mode for a -f argument, -1 if unknown
+static inline int prefilter_parse(const char *name) {
+    if (strcmp(name, "none") == 0) return PREFILTER_NONE;
+    if (strcmp(name, "even") == 0) return PREFILTER_EVEN;
+    if (strcmp(name, "wheel") == 0) return PREFILTER_WHEEL;
+    return -1;
+}
+
+static inline const char *prefilter_name(int mode) {
+    return mode == PREFILTER_EVEN ? "even" : mode == PREFILTER_WHEEL ? "wheel" : "none";
+}
+
+// Index of n % 900 among the wheel residues, -1 if it is not one
+static inline int wheel_index(long long n) {
+    int r = (int)(n % WHEEL_MODULUS);
+    for (int k = 0; k < WHEEL_RESIDUES; k++) {
+        if (wheel_residues[k] == r) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// Can n be perfect as far as the filter can tell?
+static inline int prefilter_accepts(int mode, long long n) {
+    switch (mode) {
+        case PREFILTER_EVEN:
+            return n % 2 == 0;
+        case PREFILTER_WHEEL:
+            return n == 6 || wheel_index(n) >= 0;
+        default:
+            return 1;
+    }
+}
+
+// Position of an accepted n among all candidates; wheel rank 0 is the exception 6
+static inline long long prefilter_rank(int mode, long long n) {
+    switch (mode) {
+        case PREFILTER_EVEN:
+            return n / 2;
+        case PREFILTER_WHEEL:
+            return n == 6 ? 0 : 1 + n / WHEEL_MODULUS * WHEEL_RESIDUES + wheel_index(n);
+        default:
+            return n;
+    }
+}
+
+// Candidate with the given rank
+static inline long long prefilter_unrank(int mode, long long rank) {
+    switch (mode) {
+        case PREFILTER_EVEN:
+            return rank * 2;
+        case PREFILTER_WHEEL:
+            if (rank == 0) {
+                return 6;
+            }
+            rank--;
+            return rank / WHEEL_RESIDUES * WHEEL_MODULUS + wheel_residues[rank % WHEEL_RESIDUES];
+        default:
+            return rank;
+    }
+}
+
+// Rank of the smallest candidate >= n
+static inline long long prefilter_first_rank(int mode, long long n) {
+    switch (mode) {
+        case PREFILTER_EVEN:
+            return (n + 1) / 2;
+        case PREFILTER_WHEEL: {
+            if (n <= 6) {
+                return 0;
+            }
+            long long base = n / WHEEL_MODULUS;
+            int r = (int)(n % WHEEL_MODULUS);
+            int k = 0;
+            while (k < WHEEL_RESIDUES && wheel_residues[k] < r) {
+                k++;
+            }
+            return 1 + base * WHEEL_RESIDUES + k;  // k == WHEEL_RESIDUES rolls over to the next period
+        }
+        default:
+            return n;
+    }
+}
+
+#endif
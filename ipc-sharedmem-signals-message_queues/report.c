@@ -1,10 +1,42 @@
 #include "defs.h"
+#include "prefilter.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+
+#define COVERAGE_WORDS (BITMAP_SIZE / 8)
+#define COVERAGE_SEGMENTS 32   // rows of the fill histogram
+#define COVERAGE_LISTED 10     // covered ranges and gaps printed
+#define HISTOGRAM_WIDTH 40
+
+// Counter ratios for a compute -P worker; n/a for counters it could not open
+void print_counters(const Process *p) {
+    if (p->perf_counters == 0 || p->perf_blocks == 0) {
+        return;
+    }
+    char cycles[32] = "n/a", ipc[32] = "n/a", branch[32] = "n/a", llc[32] = "n/a";
+    double tested = p->tested_count > 0 ? p->tested_count : 1;
+    if (p->perf_counters & PERF_CYCLES) {
+        snprintf(cycles, sizeof(cycles), "%.0f", p->cycles / tested);
+    }
+    if ((p->perf_counters & PERF_CYCLES) && (p->perf_counters & PERF_INSTRUCTIONS) && p->cycles > 0) {
+        snprintf(ipc, sizeof(ipc), "%.2f", (double)p->instructions / p->cycles);
+    }
+    if (p->perf_counters & PERF_BRANCH_MISSES) {
+        snprintf(branch, sizeof(branch), "%.1f", p->branch_misses / tested);
+    }
+    if (p->perf_counters & PERF_LLC_MISSES) {
+        snprintf(llc, sizeof(llc), "%.2f", p->llc_misses / tested);
+    }
+    printf("    cycles/number: %s, IPC: %s, branch-misses/number: %s, LLC-misses/number: %s (%llu blocks)\n",
+           cycles, ipc, branch, llc, p->perf_blocks);
+}
 
 void print_report() {
     // Access shared memory
@@ -22,12 +54,13 @@ void print_report() {
     int total_found = 0;
     int total_tested = 0;
     int total_skipped = 0;
+    long long total_filtered = 0;
     printf("Perfect Numbers Found:\n");
 
     // Print perfect numbers
     for (int i = 0; i < MAX_PERFECT_NUMS; i++) {
         if (shared_mem->perfect_numbers[i] != 0) {
-            printf("%d ", shared_mem->perfect_numbers[i]);
+            printf("%lld ", shared_mem->perfect_numbers[i]);
             total_found++;
         }
     }
@@ -36,33 +69,207 @@ void print_report() {
     // Print individual process stats
     for (int i = 0; i < MAX_PROCESSES; i++) {
         if (shared_mem->processes[i].pid != 0) {
-            printf("pid(%d): found: %d, tested: %d, skipped: %d\n",
+            printf("pid(%d)%s: found: %d, tested: %d, skipped: %d, filtered: %d\n",
                    shared_mem->processes[i].pid,
+                   shared_mem->processes[i].remote ? " remote" : "",
                    shared_mem->processes[i].perfect_count,
                    shared_mem->processes[i].tested_count,
-                   shared_mem->processes[i].skipped_count);
+                   shared_mem->processes[i].skipped_count,
+                   shared_mem->processes[i].filtered_count);
+
+            print_counters(&shared_mem->processes[i]);
 
             total_tested += shared_mem->processes[i].tested_count;
             total_skipped += shared_mem->processes[i].skipped_count;
+            total_filtered += shared_mem->processes[i].filtered_count;
         }
     }
 
+    // Remote workers that disconnected gave their slots back; their counts live on here
+    Process *gone = &shared_mem->terminated_stats;
+    if (gone->tested_count != 0 || gone->filtered_count != 0) {
+        printf("disconnected remote workers: found: %d, tested: %d, skipped: %d, filtered: %d\n",
+               gone->perfect_count, gone->tested_count, gone->skipped_count, gone->filtered_count);
+        total_tested += gone->tested_count;
+        total_skipped += gone->skipped_count;
+        total_filtered += gone->filtered_count;
+    }
+
     // Print summary statistics
     printf("Statistics:\n");
     printf("Total found:   %d\n", total_found);
     printf("Total tested:  %d\n", total_tested);
     printf("Total skipped: %d\n", total_skipped);
+    printf("Total filtered: %lld (%s prefilter)\n", total_filtered, prefilter_name(shared_mem->prefilter));
+}
+
+
+// First bit at or after from that is set (or clear, for want_set == 0); COVERAGE_WORDS * 64 if none
+static long long next_bit(const uint64_t *words, long long from, int want_set) {
+    long long i = from / 64;
+    if (i >= COVERAGE_WORDS) {
+        return (long long)COVERAGE_WORDS * 64;
+    }
+    uint64_t w = want_set ? words[i] : ~words[i];
+    w &= ~0ULL << (from % 64);
+    while (w == 0) {
+        if (++i == COVERAGE_WORDS) {
+            return (long long)COVERAGE_WORDS * 64;
+        }
+        w = want_set ? words[i] : ~words[i];
+    }
+    return i * 64 + __builtin_ctzll(w);
+}
+
+typedef struct {
+    long long start, end;  // numbers
+} Interval;
+
+// Keep the COVERAGE_LISTED largest gaps, biggest first
+static void keep_largest(Interval *top, int *count, Interval gap) {
+    long long size = gap.end - gap.start;
+    int pos = *count < COVERAGE_LISTED ? (*count)++ : COVERAGE_LISTED;
+    while (pos > 0 && top[pos - 1].end - top[pos - 1].start < size) {
+        if (pos < COVERAGE_LISTED) {
+            top[pos] = top[pos - 1];
+        }
+        pos--;
+    }
+    if (pos < COVERAGE_LISTED) {
+        top[pos] = gap;
+    }
+}
+
+// --coverage: which numbers have been tested, scanning a snapshot of the bitmap a word at a time.
+// Takes no lock, so a worker that is running may have claimed a few more bits by the time this prints.
+void print_coverage() {
+    int shm_id = shmget(SHM_KEY, sizeof(SharedMemory), 0666);
+    if (shm_id == -1) {
+        perror("shmget failed");
+        exit(1);
+    }
+    SharedMemory *shared_mem = (SharedMemory *)shmat(shm_id, NULL, SHM_RDONLY);
+    if (shared_mem == (void *)-1) {
+        perror("shmat failed");
+        exit(1);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    uint64_t *words = (uint64_t *)malloc(BITMAP_SIZE);
+    if (words == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(words, shared_mem->bitmap, BITMAP_SIZE);
+    int mode = shared_mem->prefilter;
+    long long bits = (long long)COVERAGE_WORDS * 64;
+
+    // Fill per segment and in total
+    long long per_segment = bits / COVERAGE_SEGMENTS;
+    long long segment_set[COVERAGE_SEGMENTS] = {0};
+    long long total_set = 0;
+    for (long long i = 0; i < COVERAGE_WORDS; i++) {
+        int n = __builtin_popcountll(words[i]);
+        segment_set[i * 64 / per_segment] += n;
+        total_set += n;
+    }
+
+    // Walk alternating runs of tested and untested ranks; numbers between two candidates
+    // belong to the run of the first, since the prefilter ruled them out
+    Interval covered[COVERAGE_LISTED], gaps[COVERAGE_LISTED];
+    int covered_count = 0, gap_count = 0;
+    long long covered_runs = 0, gap_runs = 0;
+    long long r = 0;
+    while (r < bits) {
+        long long set = next_bit(words, r, 1);
+        if (set > r) {
+            Interval gap = {prefilter_unrank(mode, r), prefilter_unrank(mode, set)};
+            keep_largest(gaps, &gap_count, gap);
+            gap_runs++;
+        }
+        if (set >= bits) {
+            break;
+        }
+        long long clear = next_bit(words, set, 0);
+        if (covered_count < COVERAGE_LISTED) {
+            covered[covered_count].start = prefilter_unrank(mode, set);
+            covered[covered_count].end = prefilter_unrank(mode, clear);
+            covered_count++;
+        }
+        covered_runs++;
+        r = clear;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+
+    printf("Coverage (%s prefilter): %lld of %lld candidates tested (%.4f%%), numbers below %lld, scanned in %.2f ms\n",
+           prefilter_name(mode), total_set, bits, 100.0 * total_set / bits, prefilter_unrank(mode, bits), ms);
+
+    printf("Covered ranges:\n");
+    for (int i = 0; i < covered_count; i++) {
+        printf("  [%lld, %lld)\n", covered[i].start, covered[i].end);
+    }
+    if (covered_runs > covered_count) {
+        printf("  ... %lld more\n", covered_runs - covered_count);
+    }
+
+    printf("Largest untested intervals:\n");
+    for (int i = 0; i < gap_count; i++) {
+        printf("  [%lld, %lld)  %lld numbers  (compute %lld)\n",
+               gaps[i].start, gaps[i].end, gaps[i].end - gaps[i].start, gaps[i].start);
+    }
+    if (gap_runs > gap_count) {
+        printf("  ... %lld more\n", gap_runs - gap_count);
+    }
+
+    printf("Fill by segment:\n");
+    for (int s = 0; s < COVERAGE_SEGMENTS; s++) {
+        double fill = (double)segment_set[s] / per_segment;
+        int width = (int)(fill * HISTOGRAM_WIDTH + 0.5);
+        if (width == 0 && segment_set[s] > 0) {
+            width = 1;  // show that something has been tested
+        }
+        printf("  [%12lld, %12lld) %7.3f%% |%-*.*s|\n",
+               prefilter_unrank(mode, s * per_segment), prefilter_unrank(mode, (s + 1) * per_segment),
+               100.0 * fill, HISTOGRAM_WIDTH, width, "########################################");
+    }
+
+    free(words);
+    shmdt(shared_mem);
 }
 
 
 // Main function
 int main(int argc, char *argv[]) {
     int shutdown = 0;
-    if (argc == 2 && strcmp(argv[1], "-k") == 0) {
-        shutdown = 1; //mark the -k flag
+    int coverage = 0;
+    int opt;
+
+    static struct option long_options[] = {
+        {"coverage", no_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "kc", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k':
+                shutdown = 1; //mark the -k flag
+                break;
+            case 'c': // tested ranges, gaps and fill of the bitmap
+                coverage = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-k] [-c|--coverage]\n", argv[0]);
+                exit(1);
+        }
     }
     
     print_report();
+    if (coverage) {
+        print_coverage();
+    }
 
     key_t shm_key = SHM_KEY;
     int shm_id = shmget(shm_key, sizeof(SharedMemory), 0666);